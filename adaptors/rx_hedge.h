@@ -0,0 +1,68 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+/// \brief races the observable returned from make() against a duplicate
+/// that is only subscribed if nothing was emitted within delay.
+/// the delay runs on timercontext, which is shared by the hedges of a subscription.
+const auto hedged = [](auto timercontext, auto delay, auto make){
+    info("new hedged");
+    return make_observable([=](auto scrb){
+        info("hedged bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("hedged bound to context");
+            auto r = scrb.create(ctx);
+            auto race = make_state<race_state>(ctx.lifetime);
+            race_start(race, make(), r, ctx);
+
+            subscription lifetime;
+            if (race.get().enter(lifetime) < 0) {
+                return ctx.lifetime;
+            }
+            ctx.lifetime.insert(lifetime);
+            if (lifetime.is_stopped()) {
+                return ctx.lifetime;
+            }
+            info("hedged started");
+            defer_after(timercontext, delay, make_observer(lifetime, [=](auto& ){
+                if (!race.get().is_won()) {
+                    info("hedged: delay expired, start duplicate");
+                    race_start(race, make(), r, ctx);
+                }
+            }));
+            return ctx.lifetime;
+        });
+    });
+};
+
+}
+
+/// \brief for each value, subscribes the observable returned from f(v) and
+/// subscribes a duplicate f(v) if the first has not emitted within delay.
+/// only the first of the two to emit is merged into the output.
+/// the delays of all the values run on one strand from makeStrand.
+template<class MakeStrand, class Duration, class F>
+auto hedge(MakeStrand makeStrand, Duration delay, F f) {
+    info("new hedge");
+    return make_adaptor([=](auto source){
+        info("hedge bound to source");
+        return make_observable([=](auto scrb){
+            info("hedge bound to subscriber");
+            return make_starter([=](auto ctx) {
+                info("hedge bound to context");
+                auto timercontext = copy_context(ctx.lifetime, makeStrand, ctx);
+                return source |
+                    transform([=](auto v){
+                        return detail::hedged(timercontext, delay, [=](){return f(v);});
+                    }) |
+                    merge(makeStrand) |
+                    scrb |
+                    ctx;
+            });
+        });
+    });
+}
+
+}
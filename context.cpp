@@ -112,9 +112,14 @@ int EMSCRIPTEN_KEEPALIVE main() {
 
 int main() {
     designcontext(0, 100);
-    loop.run();
 
-    return 0;
+    // run what was deferred to the loop until nothing is left
+    Ticks::guard_type guard(loop.loop.get().lock);
+    while (!loop.loop.get().deferred.empty() && loop.wait(guard)) {
+        loop.step(guard, 3600s);
+    }
+
+    return failed_checks == 0 ? 0 : 1;
 }
 
 #endif
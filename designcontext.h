@@ -14,6 +14,25 @@ struct cstr_or_string {
     void operator()(const string& s) const {cout <<  "string - " << s << endl;}
 };
 
+/// the number of checks that failed, main() returns 1 when any did
+int failed_checks = 0;
+
+const auto expect = [](bool passed, const string& what){
+    cout << (passed ? "passed - " : "FAILED - ") << what << endl;
+    if (!passed) {
+        ++failed_checks;
+    }
+};
+
+/// \brief appends each value to values, which are read after the subscription is joined
+const auto collect = [](auto values){
+    return make_subscriber([=](auto ctx){
+        return make_observer(ctx.lifetime, [=](auto v){
+            values->push_back(move(v));
+        });
+    });
+};
+
 const auto text = [](){
     info("new text");
     return make_observable([=](auto scrb){
@@ -355,6 +374,1152 @@ this_thread::sleep_for(2s);
 cout << endl;
 #endif
 
+#if !RX_SKIP_TESTS
+{
+ output("race");
+    auto values = make_shared<vector<long>>();
+    auto loserstopped = make_shared<atomic<bool>>(false);
+    race(
+        intervals(make_new_thread<>{}, steady_clock::now() + 500ms, 10ms) |
+            observe_on(makeThread) |
+            take(3) |
+            transform([](long v){return v + 100;}) |
+            finally([=](){*loserstopped = true;}),
+        intervals(make_new_thread<>{}, steady_clock::now(), 10ms) |
+            observe_on(makeThread) |
+            take(3)) |
+        as_interface<long>() |
+        collect(values) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(*values == vector<long>{0, 1, 2}, "race forwards only the first source to emit");
+    expect(*loserstopped, "race stops the sources that lost");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("hedge");
+    auto strands = make_shared<atomic<int>>(0);
+    auto countedThread = [=](subscription lifetime){
+        ++*strands;
+        return makeThread(lifetime);
+    };
+    auto attempts = make_shared<atomic<int>>(0);
+    auto slowstopped = make_shared<atomic<bool>>(false);
+    auto values = make_shared<vector<long>>();
+    ints(1, 20) |
+        hedge(countedThread, 50ms, [=](int i){
+            auto attempt = (*attempts)++;
+            // the first attempt for 2 is slow, its duplicate wins
+            auto slow = i == 2 && attempt < 2;
+            return intervals(make_new_thread<>{}, steady_clock::now() + (slow ? 1s : 1ms), 10ms) |
+                observe_on(makeThread) |
+                take(1) |
+                transform([=](long){return slow ? -1L : long(i);}) |
+                finally([=](){if (slow) *slowstopped = true;}) |
+                as_interface<long>();
+        }) |
+        as_interface<long>() |
+        collect(values) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    sort(values->begin(), values->end());
+    vector<long> expected;
+    for (long i = 1; i <= 20; ++i) {
+        expected.push_back(i);
+    }
+    expect(*values == expected, "hedge emits one result for each value");
+    expect(*slowstopped, "hedge stops the attempt that lost to its duplicate");
+    expect(*strands < 4, "hedge uses one timer strand for every value - " + to_string(strands->load()) + " strands");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("conflate");
+    auto values = make_shared<vector<int>>();
+    ints(0, 20000) |
+        conflate(makeThread) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](int v){
+                values->push_back(v);
+                this_thread::sleep_for(10us);
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(!values->empty() && values->back() == 20000, "conflate delivers the latest value");
+    expect(values->size() < 20001 && is_sorted(values->begin(), values->end()), "conflate drops the values that were replaced - " + to_string(values->size()) + " delivered");
+
+    auto latest = make_shared<map<int, int>>();
+    auto delivered = make_shared<int>(0);
+    ints(0, 20000) |
+        conflate_by_key(makeThread, [](int v){return v % 3;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](int v){
+                (*latest)[v % 3] = v;
+                ++*delivered;
+                this_thread::sleep_for(10us);
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(*latest == map<int, int>{{0, 19998}, {1, 19999}, {2, 20000}}, "conflate_by_key delivers the latest value for each key");
+    expect(*delivered < 20001, "conflate_by_key drops the values that were replaced - " + to_string(*delivered) + " delivered");
+
+    auto typed = make_shared<vector<string>>();
+    text() |
+        conflate(makeThread) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](auto v){
+                typed->push_back(string(v));
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    sort(typed->begin(), typed->end());
+    expect(*typed == vector<string>{"hello", "world"}, "conflate keeps the latest value of each type");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("shed_load");
+    auto overloaded = shed_load_policy{1ms, 10ms};
+    ints(0, 20000) |
+        shed_load(makeThread, overloaded) |
+        make_subscriber([](auto ctx){
+            return make_observer(ctx.lifetime, [](int){
+                this_thread::sleep_for(20us);
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    auto& o = *overloaded.counters;
+    expect(o.dropped > 0 && o.delivered + o.dropped == 20001, "shed_load drops values while the strand is overloaded - " + to_string(o.dropped) + " dropped");
+
+    auto degraded = shed_load_policy{1ms, 10ms};
+    auto negative = make_shared<long>(0);
+    ints(0, 20000) |
+        shed_load(makeThread, degraded, [](int v){return -v;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](int v){
+                if (v < 0) {
+                    ++*negative;
+                }
+                this_thread::sleep_for(20us);
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    auto& d = *degraded.counters;
+    expect(d.degraded > 0 && d.dropped == 0 && *negative == d.degraded, "shed_load delivers degrade(v) instead of dropping");
+
+    auto idle = shed_load_policy{1ms, 10ms};
+    intervals(make_new_thread<>{}, steady_clock::now(), 1ms) |
+        take(50) |
+        shed_load(makeThread, idle) |
+        make_subscriber([](auto ctx){
+            return make_observer(ctx.lifetime, [](long){});
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(idle.counters->delivered == 50 && idle.counters->dropped == 0, "shed_load delivers every value while the strand keeps up");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("adaptive_batch");
+    auto values = make_shared<vector<int>>();
+    auto largest = make_shared<size_t>(0);
+    ints(1, 5000) |
+        adaptive_batch(makeThread, adaptive_batch_policy{10ms, 1, 64}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](vector<int> batch){
+                *largest = max(*largest, batch.size());
+                values->insert(values->end(), batch.begin(), batch.end());
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    vector<int> expected;
+    for (int i = 1; i <= 5000; ++i) {
+        expected.push_back(i);
+    }
+    expect(*values == expected, "adaptive_batch delivers every value in order");
+    expect(*largest > 0 && *largest <= 64, "adaptive_batch keeps batches within max_size - " + to_string(*largest) + " largest");
+
+    auto words = make_shared<vector<string>>();
+    text() |
+        adaptive_batch(makeThread) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](auto batch){
+                for (auto& w : batch) {
+                    words->push_back(string(w));
+                }
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    sort(words->begin(), words->end());
+    expect(*words == vector<string>{"hello", "world"}, "adaptive_batch batches values of each type separately");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("circuit_breaker");
+    auto calls = make_shared<int>(0);
+    auto call = circuit_breaker(circuit_breaker_config{0.5, 4, 200ms, 1}, [=](int v){
+        ++*calls;
+        return make_observable([=](auto scrb){
+            return make_starter([=](auto ctx){
+                auto r = scrb.create(ctx);
+                if (v < 0) {
+                    r.error(make_exception_ptr(runtime_error("call failed")));
+                } else {
+                    r.next(v);
+                    r.complete();
+                }
+                return ctx.lifetime;
+            });
+        });
+    });
+    // "value", "failed" or "open"
+    auto outcome = [=](int v){
+        auto result = make_shared<string>();
+        call(v) |
+            make_subscriber([=](auto ctx){
+                return make_observer(ctx.lifetime,
+                    [=](int){*result = "value";},
+                    [=](exception_ptr e){
+                        try { rethrow_exception(e); }
+                        catch (const circuit_open_error&) { *result = "open"; }
+                        catch (...) { *result = "failed"; }
+                    });
+            }) |
+            start();
+        return *result;
+    };
+    for (int i = 0; i < 4; ++i) {
+        outcome(-1);
+    }
+    expect(outcome(1) == "open" && *calls == 4, "circuit_breaker fails fast once the failure rate is reached");
+    this_thread::sleep_for(250ms);
+    expect(outcome(1) == "value" && *calls == 5, "circuit_breaker lets a probe through after open_duration");
+    expect(outcome(1) == "value", "circuit_breaker closes after a successful probe");
+    for (int i = 0; i < 4; ++i) {
+        outcome(-1);
+    }
+    this_thread::sleep_for(250ms);
+    expect(outcome(-1) == "failed" && outcome(1) == "open", "circuit_breaker opens again after a failed probe");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("reorder_by_time");
+    const vector<int> arrivals{5, 1, 3, 2, 9, 4, 8, 7, 12};
+    auto reordered = [=](reorder_late late){
+        auto values = make_shared<vector<int>>();
+        ints(0, int(arrivals.size()) - 1) |
+            transform([=](int i){return arrivals[i];}) |
+            reorder_by_time([](int v){return v;}, 3, late) |
+            collect(values) |
+            start();
+        return *values;
+    };
+    expect(reordered(reorder_late::drop) == vector<int>{2, 3, 5, 7, 8, 9, 12}, "reorder_by_time orders by timestamp and drops late values");
+    expect(reordered(reorder_late::emit) == vector<int>{1, 2, 3, 5, 4, 7, 8, 9, 12}, "reorder_by_time emits late values when they arrive");
+
+    auto mixed = make_shared<bool>(false);
+    text() |
+        reorder_by_time([](auto){return 0;}, 0) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](auto){}, [=](exception_ptr){*mixed = true;});
+        }) |
+        start();
+    expect(*mixed, "reorder_by_time delivers an error for values of a second type");
+
+    auto base = steady_clock::now();
+    auto timed = make_shared<vector<int>>();
+    auto late = make_shared<steady_clock::time_point>();
+    // 1 arrives 100ms after 0 with an earlier timestamp
+    const vector<milliseconds> stamps{20ms, 0ms, 200ms, 300ms};
+    intervals(make_new_thread<>{}, base, 100ms) |
+        take(4) |
+        transform([=](long i){return make_pair(base + stamps[i], int(i));}) |
+        reorder_by_time(makeThread, [](const pair<steady_clock::time_point, int>& p){return p.first;}, 150ms) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](pair<steady_clock::time_point, int> p){
+                timed->push_back(p.second);
+                if (p.second == 0) {
+                    *late = steady_clock::now();
+                }
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(*timed == vector<int>{1, 0, 2, 3}, "reorder_by_time on a strand orders by timestamp");
+    expect(*late - base < 250ms, "reorder_by_time on a strand releases held values with a timer");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("session_window");
+    auto sums = make_shared<map<int, int>>();
+    ints(0, 9) |
+        session_window(makeThread, [](int v){return v % 2;}, 1s, 0, [](int acc, int v){return acc + v;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](auto s){
+                (*sums)[s.key] = s.value;
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(*sums == map<int, int>{{0, 20}, {1, 25}}, "session_window folds the values of each key and closes the sessions on complete");
+
+    auto base = steady_clock::now();
+    auto sessions = make_shared<vector<pair<vector<long>, steady_clock::time_point>>>();
+    // key 0 goes quiet after 100ms, key 1 stays active until 450ms
+    intervals(make_new_thread<>{}, base, 50ms) |
+        take(10) |
+        session_window(makeThread, [](long v){return v < 3 ? 0 : 1;}, 80ms) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](auto s){
+                sessions->push_back(make_pair(s.value, steady_clock::now()));
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(sessions->size() == 2 && sessions->front().first == vector<long>{0, 1, 2} && sessions->back().first == vector<long>{3, 4, 5, 6, 7, 8, 9}, "session_window collects the values of each session");
+    expect(sessions->size() == 2 && sessions->front().second - base < 350ms, "session_window closes a session after the gap without waiting for complete");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("merge_join");
+    auto pairs = make_shared<vector<pair<int, int>>>();
+    merge_join(ints(0, 9), ints(0, 9) | transform([](int v){return v * 2;}), [](int l){return l;}, [](int r){return r;}) |
+        collect(pairs) |
+        start();
+    expect(*pairs == vector<pair<int, int>>{{0, 0}, {2, 2}, {4, 4}, {6, 6}, {8, 8}}, "merge_join pairs the values with equal keys");
+
+    auto overflow = make_shared<bool>(false);
+    // both sides produce on the thread of makeThread, the right side starts late
+    merge_join(
+        intervals(make_new_thread<>{}, steady_clock::now(), 1ms) | take(200) | observe_on(makeThread),
+        intervals(make_new_thread<>{}, steady_clock::now() + 50ms, 1ms) | take(200) | observe_on(makeThread),
+        [](long l){return l;}, [](long r){return r;}, 8) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](pair<long, long>){}, [=](exception_ptr e){
+                try { rethrow_exception(e); }
+                catch (const merge_join_overflow&) { *overflow = true; }
+                catch (...) {}
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(*overflow, "merge_join delivers merge_join_overflow instead of blocking the thread of both sides");
+
+    auto early = make_shared<bool>(false);
+    auto earlypairs = make_shared<int>(0);
+    // the left side completes before the right side is subscribed
+    merge_join(ints(0, 99), ints(0, 99), [](int l){return l;}, [](int r){return r;}, 8) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](pair<int, int>){++*earlypairs;}, [=](exception_ptr e){
+                try { rethrow_exception(e); }
+                catch (const merge_join_overflow&) { *early = true; }
+                catch (...) {}
+            });
+        }) |
+        start();
+    expect(*early && *earlypairs == 0, "merge_join bounds a side before the other side has produced");
+
+    auto bounded = make_shared<vector<pair<long, long>>>();
+    auto leftThread = make_shared_make_strand(make_new_thread<>{});
+    auto rightThread = make_shared_make_strand(make_new_thread<>{});
+    // the right side produces first so that the faster left side can wait for it
+    merge_join(
+        intervals(make_new_thread<>{}, steady_clock::now() + 5ms, 1ms) | take(50) | observe_on(leftThread),
+        intervals(make_new_thread<>{}, steady_clock::now(), 3ms) | take(50) | observe_on(rightThread),
+        [](long l){return l;}, [](long r){return r;}, 8) |
+        collect(bounded) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    auto matched = bounded->size() == 50;
+    for (long i = 0; matched && i < 50; ++i) {
+        matched = (*bounded)[i] == make_pair(i, i);
+    }
+    expect(matched, "merge_join waits for room when the sides run on different threads");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("lookup_join");
+    auto table = lookup_table<int, string>({{1, "one"}, {2, "two"}});
+    weak_ptr<const lookup_table<int, string>::index_type> first = table.current();
+    auto joined = make_shared<vector<string>>();
+    auto released = make_shared<bool>(false);
+    make_observable([=](auto scrb){
+        return make_starter([=](auto ctx){
+            auto r = scrb.create(ctx);
+            r.next(1);
+            r.next(3);
+            table.publish({{1, "uno"}, {2, "dos"}});
+            r.next(2);
+            *released = first.expired();
+            r.complete();
+            return ctx.lifetime;
+        });
+    }) |
+        lookup_join(table, [](int v){return v;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](pair<int, string> p){
+                joined->push_back(p.second);
+            });
+        }) |
+        start();
+    expect(*joined == vector<string>{"one", "dos"}, "lookup_join joins with the index that is current for each value");
+    expect(*released, "lookup_join releases a replaced index when the next value sees the new version");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("filter_in");
+    bloom_set<long> evens({0L, 2L, 4L, 6L, 8L});
+    auto in = make_shared<vector<int>>();
+    ints(0, 9) |
+        filter_in(evens) |
+        collect(in) |
+        start();
+    expect(*in == vector<int>{0, 2, 4, 6, 8}, "filter_in converts the values to the set type and passes the members");
+
+    auto out = make_shared<vector<vector<long>>>();
+    make_observable([=](auto scrb){
+        return make_starter([=](auto ctx){
+            auto r = scrb.create(ctx);
+            r.next(vector<long>{1, 2, 3, 4});
+            r.next(vector<long>{0, 8});
+            r.next(vector<long>{5, 7, 9});
+            r.complete();
+            return ctx.lifetime;
+        });
+    }) |
+        filter_not_in(evens) |
+        collect(out) |
+        start();
+    expect(*out == vector<vector<long>>{{1, 3}, {5, 7, 9}}, "filter_not_in filters batches and skips the empty ones");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("record_batch columns");
+    auto batches = [](){
+        return make_observable([](auto scrb){
+            return make_starter([=](auto ctx){
+                auto r = scrb.create(ctx);
+                for (int b = 0; b < 2; ++b) {
+                    record_batch<int, double> batch;
+                    for (int i = 1; i <= 4; ++i) {
+                        batch.push_back(b * 4 + i, (b * 4 + i) + 0.5);
+                    }
+                    r.next(move(batch));
+                }
+                r.complete();
+                return ctx.lifetime;
+            });
+        });
+    };
+    auto rows = make_shared<vector<int>>();
+    batches() |
+        copy_if_column<0>([](int v){return v % 2 == 0;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](record_batch<int, double> batch){
+                batch.for_each_row([&](size_t row){
+                    rows->push_back(get_column<0>(batch)[row]);
+                });
+            });
+        }) |
+        start();
+    expect(*rows == vector<int>{2, 4, 6, 8}, "copy_if_column selects the rows where the predicate holds");
+
+    auto total = make_shared<vector<double>>();
+    batches() |
+        copy_if_column<0>([](int v){return v > 6;}) |
+        transform_column<1, 0, 1>([](int a, double b){return a * b;}) |
+        reduce_column<1>(0.0, [](double acc, double v){return acc + v;}) |
+        collect(total) |
+        start();
+    expect(*total == vector<double>{7 * 7.5 + 8 * 8.5}, "transform_column and reduce_column fold the selected rows");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("columnar file");
+    auto path = "/tmp/rx-designcontext-" + to_string(::getpid()) + ".columnar";
+    make_observable([](auto scrb){
+        return make_starter([=](auto ctx){
+            auto r = scrb.create(ctx);
+            for (int b = 0; b < 2; ++b) {
+                record_batch<int, double> batch;
+                for (int i = 1; i <= 4; ++i) {
+                    batch.push_back(b * 4 + i, (b * 4 + i) + 0.5);
+                }
+                r.next(move(batch));
+            }
+            r.complete();
+            return ctx.lifetime;
+        });
+    }) |
+        write_columnar(path) |
+        make_subscriber([](auto ctx){
+            return make_observer(ctx.lifetime, [](const record_batch<int, double>&){});
+        }) |
+        start();
+    auto scanned = [=](columnar_scan scan){
+        auto rows = make_shared<vector<pair<int, double>>>();
+        read_columnar<int, double>(path, scan) |
+            make_subscriber([=](auto ctx){
+                return make_observer(ctx.lifetime, [=](record_batch_view<int, double> batch){
+                    batch.for_each_row([&](size_t row){
+                        rows->push_back(make_pair(get_column<0>(batch)[row], get_column<1>(batch)[row]));
+                    });
+                });
+            }) |
+            start();
+        return *rows;
+    };
+    auto all = scanned(columnar_scan{});
+    expect(all.size() == 8 && all.front() == make_pair(1, 1.5) && all.back() == make_pair(8, 8.5), "read_columnar reads the batches written by write_columnar");
+    auto high = scanned(columnar_scan{}.where(0, 6, 100));
+    expect(high.size() == 4 && high.front().first == 5, "read_columnar skips the row groups outside the where range");
+    ::unlink(path.c_str());
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("parse_csv");
+    auto chunks = [](){
+        return make_observable([](auto scrb){
+            return make_starter([=](auto ctx){
+                auto r = scrb.create(ctx);
+                r.next(string("id,text\n1,\"a,"));
+                r.next(string("b\"\n2,5\" tall\n3,\"x\"\"y\"\n4,"));
+                r.complete();
+                return ctx.lifetime;
+            });
+        });
+    };
+    auto fields = make_shared<vector<string>>();
+    auto names = make_shared<vector<string>>();
+    chunks() |
+        parse_csv(csv_format{',', true}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](const csv_batch& batch){
+                *names = *batch.names;
+                for (size_t row = 0; row < batch.rows; ++row) {
+                    for (size_t col = 0; col < batch.width; ++col) {
+                        fields->push_back(batch.str(row, col));
+                    }
+                }
+            });
+        }) |
+        start();
+    expect(*names == vector<string>{"id", "text"}, "parse_csv reads the column names from the header");
+    expect(*fields == vector<string>{"1", "a,b", "2", "5\" tall", "3", "x\"y", "4", ""}, "parse_csv joins rows split across chunks and only opens quotes at the start of a field");
+
+    auto ids = make_shared<vector<int>>();
+    auto texts = make_shared<vector<string>>();
+    chunks() |
+        parse_csv<int, string>(csv_format{',', true}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](const record_batch<int, string>& batch){
+                for (size_t row = 0; row < batch.rows; ++row) {
+                    ids->push_back(get_column<0>(batch)[row]);
+                    texts->push_back(get_column<1>(batch)[row]);
+                }
+            });
+        }) |
+        start();
+    expect(*ids == vector<int>{1, 2, 3, 4} && texts->size() == 4 && (*texts)[2] == "x\"y", "parse_csv converts the columns of a record_batch");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("contains");
+    const vector<string> lines{
+        "a needle at the start of a line that is longer than one block",
+        "no match in this line, which is also longer than thirty two bytes",
+        "short needle",
+        "the last bytes of this long line hold the pattern at the very end needle",
+        "needl"};
+    auto found = make_shared<vector<string>>();
+    ints(0, int(lines.size()) - 1) |
+        transform([=](int i){return lines[i];}) |
+        contains("needle") |
+        collect(found) |
+        start();
+    expect(*found == vector<string>{lines[0], lines[2], lines[3]}, "contains passes the lines with the pattern anywhere in them");
+
+    auto any = make_shared<vector<vector<string>>>();
+    ints(0, 0) |
+        transform([=](int){return lines;}) |
+        contains_any({"thirty", "short", "missing"}) |
+        collect(any) |
+        start();
+    expect(*any == vector<vector<string>>{{lines[1], lines[2]}}, "contains_any filters a batch by any of the patterns");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("frame");
+    const vector<string> payloads{"a", "", "a payload that spans several of the chunks"};
+    auto frames = make_shared<vector<buffer_chain>>();
+    ints(0, int(payloads.size()) - 1) |
+        transform([=](int i){return payloads[i];}) |
+        frame_encode() |
+        collect(frames) |
+        start();
+    string wire;
+    for (auto& f : *frames) {
+        wire += f.str();
+    }
+    expect(frames->size() == 3 && frames->front().str() == string("\0\0\0\1a", 5), "frame_encode prefixes each payload with its big-endian length");
+
+    // the wire split into chunks of 3 bytes
+    auto chunked = [](string bytes){
+        return ints(0, int((bytes.size() + 2) / 3) - 1) |
+            transform([=](int i){return bytes.substr(i * 3, 3);});
+    };
+    auto decoded = make_shared<vector<string>>();
+    chunked(wire) |
+        frame_decode() |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](buffer_chain frame){
+                decoded->push_back(frame.str());
+            });
+        }) |
+        start();
+    expect(*decoded == payloads, "frame_decode reassembles frames split across chunks");
+
+    auto truncated = make_shared<bool>(false);
+    chunked(wire.substr(0, wire.size() - 1)) |
+        frame_decode() |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](buffer_chain){}, [=](exception_ptr){*truncated = true;});
+        }) |
+        start();
+    expect(*truncated, "frame_decode delivers an error when the source completes inside a frame");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("socket");
+    auto path = "/tmp/rx-designcontext-" + to_string(::getpid()) + ".sock";
+    socket_options options{8};
+    auto received = make_shared<vector<string>>();
+    auto completed = make_shared<bool>(false);
+    auto source = socket_source(path, make_new_thread<>{}, options) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime,
+                [=](buffer_chain record){received->push_back(record.str());},
+                [](exception_ptr){},
+                [=](){*completed = true;});
+        }) |
+        start();
+    auto sent = make_shared<bool>(true);
+    ints(1, 100) |
+        transform([](int i){return to_string(i);}) |
+        socket_sink(path, options) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](auto){}, [=](exception_ptr){*sent = false;});
+        }) |
+        start();
+    source.join();
+    auto matched = received->size() == 100;
+    for (int i = 0; matched && i < 100; ++i) {
+        matched = (*received)[i] == to_string(i + 1);
+    }
+    expect(*sent && matched && *completed, "socket_sink delivers every record and the completion to socket_source within the credit");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("shm_ring");
+    auto name = "/rx-designcontext-" + to_string(::getpid());
+    auto received = make_shared<vector<string>>();
+    auto completed = make_shared<bool>(false);
+    auto source = shm_ring_source(name, make_new_thread<>{}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime,
+                [=](buffer_chain record){received->push_back(record.str());},
+                [](exception_ptr){},
+                [=](){*completed = true;});
+        }) |
+        start();
+    auto in_use = make_shared<bool>(false);
+    shm_ring_source(name, make_new_thread<>{}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](buffer_chain){}, [=](exception_ptr){*in_use = true;});
+        }) |
+        start();
+    expect(*in_use, "shm_ring_source delivers an error when a live source holds the ring");
+    auto sent = make_shared<bool>(true);
+    ints(1, 100) |
+        transform([](int i){return to_string(i);}) |
+        shm_ring_sink(name) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](auto){}, [=](exception_ptr){*sent = false;});
+        }) |
+        start();
+    source.join();
+    auto matched = received->size() == 100;
+    for (int i = 0; matched && i < 100; ++i) {
+        matched = (*received)[i] == to_string(i + 1);
+    }
+    expect(*sent && matched && *completed, "shm_ring_sink delivers every record and the completion to shm_ring_source");
+
+    auto delivered = make_shared<size_t>(0);
+    auto abandoned = make_shared<bool>(false);
+    source = shm_ring_source(name, make_new_thread<>{}, shm_ring_options{4096, 2}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime,
+                [=](buffer_chain){++*delivered;},
+                [=](exception_ptr){*abandoned = true;});
+        }) |
+        start();
+    ints(1, 10) |
+        transform([](int i){return to_string(i);}) |
+        shm_ring_sink(name) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](auto){}, [](exception_ptr){});
+        }) |
+        start();
+    // a sink that exits without completing
+    rx::detail::shm_ring::open(name, seconds(5), [](){return false;}).reset();
+    source.join();
+    expect(*delivered == 10 && *abandoned, "shm_ring_source delivers the records and then an error when a sink exits without completing");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("tail_file");
+    auto existing = "/tmp/rx-designcontext-" + to_string(::getpid()) + "-existing.log";
+    auto missing = "/tmp/rx-designcontext-" + to_string(::getpid()) + "-missing.log";
+    auto append = [](const string& path, const string& text){
+        auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if (fd >= 0) {
+            auto written = ::write(fd, text.data(), text.size());
+            (void)written;
+            ::close(fd);
+        }
+    };
+    ::unlink(missing.c_str());
+    append(existing, "old\n");
+    auto lock = make_shared<mutex>();
+    auto lines = make_shared<vector<string>>();
+    auto follow = [=](const string& path){
+        return tail_file(path, make_new_thread<>{}, tail_options{false, 4096, milliseconds(20)}) |
+            make_subscriber([=](auto ctx){
+                return make_observer(ctx.lifetime,
+                    [=](string line){
+                        unique_lock<mutex> guard(*lock);
+                        lines->push_back(path == missing ? "missing " + line : line);
+                    },
+                    [](exception_ptr){});
+            }) |
+            start();
+    };
+    auto tails = vector<subscription>{follow(existing), follow(missing)};
+    append(existing, "new\n");
+    append(missing, "first\nsecond\n");
+    auto deadline = steady_clock::now() + seconds(5);
+    for (;;) {
+        unique_lock<mutex> guard(*lock);
+        if (lines->size() >= 3 || steady_clock::now() > deadline) {
+            break;
+        }
+        guard.unlock();
+        this_thread::sleep_for(milliseconds(10));
+    }
+    for (auto& t : tails) {
+        t.stop();
+        t.join();
+    }
+    sort(lines->begin(), lines->end());
+    expect(*lines == vector<string>{"missing first", "missing second", "new"}, "tail_file reads an existing file from its end and a file that appears later from its start");
+    ::unlink(existing.c_str());
+    ::unlink(missing.c_str());
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("read_file write_file");
+    auto path = "/tmp/rx-designcontext-" + to_string(::getpid()) + "-file.txt";
+    auto io = make_file_io();
+    string expected;
+    for (int i = 1; i <= 2000; ++i) {
+        expected += to_string(i) + "\n";
+    }
+    auto written = make_shared<promise<bool>>();
+    ints(1, 2000) |
+        transform([](int i){return to_string(i) + "\n";}) |
+        write_file(path, io, write_options{false, 4096}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](auto){},
+                [=](exception_ptr){written->set_value(false);},
+                [=](){written->set_value(true);});
+        }) |
+        start();
+    expect(written->get_future().get(), "write_file completes once every value is written");
+    auto read = [=](read_options options){
+        auto text = make_shared<string>();
+        auto done = make_shared<promise<bool>>();
+        read_file(path, io, make_new_thread<>{}, options) |
+            make_subscriber([=](auto ctx){
+                return make_observer(ctx.lifetime,
+                    [=](buffer_chain chunk){*text += chunk.str();},
+                    [=](exception_ptr){done->set_value(false);},
+                    [=](){done->set_value(true);});
+            }) |
+            start();
+        return done->get_future().get() ? *text : string("error");
+    };
+    expect(read(read_options{0, numeric_limits<uint64_t>::max(), 1000, 2}) == expected, "read_file reads the whole file in order in chunks");
+    expect(read(read_options{100, 5000, 1000, 3}) == expected.substr(100, 5000), "read_file reads a range of the file");
+    ::unlink(path.c_str());
+    expect(read(read_options{}) == "error", "read_file delivers an error for a missing file");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("spill_buffer");
+    auto received = make_shared<vector<string>>();
+    auto done = make_shared<promise<bool>>();
+    ints(1, 20000) |
+        transform([](int i){return to_string(i);}) |
+        spill_buffer(make_new_thread<>{}, spill_options{16, "/tmp", 4096}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime,
+                [=](string v){
+                    if (received->empty()) {
+                        // the producer runs ahead and spills
+                        this_thread::sleep_for(milliseconds(50));
+                    }
+                    received->push_back(move(v));
+                },
+                [=](exception_ptr){done->set_value(false);},
+                [=](){done->set_value(true);});
+        }) |
+        start();
+    auto completed = done->get_future().get();
+    auto matched = received->size() == 20000;
+    for (int i = 0; matched && i < 20000; ++i) {
+        matched = (*received)[i] == to_string(i + 1);
+    }
+    expect(completed && matched, "spill_buffer delivers every value in order through the spill files");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("keyed stores");
+    memory_keyed_store<int, int> counts(4);
+    for (int i = 0; i < 1000; ++i) {
+        counts.get(i % 100) += 1;
+    }
+    counts.erase(7);
+    expect(counts.size() == 99 && *counts.find(42) == 10 && !counts.find(7), "memory_keyed_store counts each key and erases a key");
+
+    auto path = "/tmp/rx-designcontext-" + to_string(::getpid()) + ".table";
+    ::unlink(path.c_str());
+    {
+        mmap_keyed_store<int, int64_t> totals(mmap_store_options{path, 16, 8});
+        for (int i = 0; i < 10000; ++i) {
+            totals.get(i % 1000) += i;
+        }
+        totals.erase(3);
+    }
+    {
+        mmap_keyed_store<int, int64_t> totals(mmap_store_options{path, 16, 8});
+        int64_t sum = 0;
+        totals.for_each([&](int, int64_t& total){sum += total;});
+        expect(totals.size() == 999 && *totals.find(5) == 45050 && !totals.find(3) && sum == 49995000 - 45030,
+            "mmap_keyed_store grows and keeps its entries when the file is opened again");
+    }
+    auto rejected = [&](){
+        try {
+            mmap_keyed_store<int, int64_t> totals(mmap_store_options{path});
+        } catch(const keyed_store_error&) {
+            return true;
+        }
+        return false;
+    };
+    expect(!rejected(), "mmap_keyed_store opens a whole table");
+    auto truncated = ::truncate(path.c_str(), 4096) == 0;
+    expect(truncated && rejected(), "mmap_keyed_store rejects a table that does not match the size of its file");
+    ::unlink(path.c_str());
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS && RX_POSIX
+{
+ output("checkpoint");
+    auto path = "/tmp/rx-designcontext-" + to_string(::getpid()) + ".checkpoint";
+    auto table = "/tmp/rx-designcontext-" + to_string(::getpid()) + ".totals";
+    ::unlink(path.c_str());
+    ::unlink(table.c_str());
+    auto io = make_file_io();
+    auto run = [=](int last){
+        auto cp = make_checkpoint(path, io);
+        subscription lifetime;
+        auto total = make_state<int64_t>(lifetime, 0);
+        auto counts = make_keyed_state<int, int>(lifetime, 4);
+        auto totals = make_keyed_state<int, int64_t>(lifetime, mmap_store_options{table, 4, 2});
+        cp->track("total", total);
+        cp->track("counts", counts);
+        cp->track("totals", totals);
+        auto count = counts.get().find(3);
+        auto sum = totals.get().find(4);
+        auto restored = make_tuple(cp->offset(), total.get(), counts.get().size(), count ? *count : 0, sum ? *sum : 0);
+        auto completed = make_shared<bool>(false);
+        ints(static_cast<int>(cp->offset()) + 1, last) |
+            checkpoint_every(cp, 40) |
+            make_subscriber([=](auto ctx){
+                return make_observer(ctx.lifetime,
+                    [=](int i){
+                        total.get() += i;
+                        counts.get().get(i % 7) += 1;
+                        totals.get().get(i % 5) += i;
+                    },
+                    [](exception_ptr){},
+                    [=](){*completed = true;});
+            }) |
+            start();
+        lifetime.stop();
+        return make_pair(*completed, restored);
+    };
+    auto first = run(100);
+    auto second = run(90);
+    expect(first.first && get<0>(first.second) == 0, "checkpoint starts without a snapshot");
+    // the snapshot after 80 values: 1..80 sums to 3240, 12 values have i % 7 == 3, i % 5 == 4 sums to 664
+    expect(second.first && second.second == make_tuple(uint64_t(80), int64_t(3240), size_t(7), 12, int64_t(664)),
+        "checkpoint restores the offset, a state and the memory and mmap stores from the last snapshot");
+
+    auto failed = make_shared<bool>(false);
+    auto missing = make_checkpoint("/tmp/rx-designcontext-" + to_string(::getpid()) + "-missing/checkpoint", io);
+    ints(1, 10) |
+        checkpoint_every(missing, 5) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](int){}, [=](exception_ptr){*failed = true;});
+        }) |
+        start();
+    expect(*failed, "checkpoint_every delivers a snapshot that fails to error");
+    ::unlink(path.c_str());
+    ::unlink(table.c_str());
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("materialize");
+    materialized_table<int, int> table(4);
+    auto reading = make_shared<atomic<bool>>(true);
+    auto consistent = make_shared<atomic<bool>>(true);
+    std::thread reader([=](){
+        while (reading->load()) {
+            table.for_each([&](int k, int v){
+                if (v % 10 != k) {
+                    *consistent = false;
+                }
+            });
+        }
+    });
+    auto changes = make_shared<int>(0);
+    ints(1, 10000) |
+        materialize(table, [](int i){return i % 10;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](int){++*changes;});
+        }) |
+        start();
+    *reading = false;
+    reader.join();
+    int last = 0;
+    expect(*changes == 10000 && table.size() == 10 && table.find(3, last) && last == 9993 && *consistent,
+        "materialize keeps the latest value of each key while another thread reads the table");
+
+    auto writer = table.claim();
+    auto refused = make_shared<bool>(false);
+    ints(1, 10) |
+        materialize(table, [](int i){return i % 10;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](int){}, [=](exception_ptr){*refused = true;});
+        }) |
+        start();
+    expect(*refused && table.find(3, last) && last == 9993, "materialize delivers an error while another writer holds the table");
+    writer.reset();
+    ints(1, 10) |
+        materialize(table, [](int i){return i % 10;}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](int){});
+        }) |
+        start();
+    expect(table.find(3, last) && last == 3, "materialize claims the table once the writer is released");
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("memoize_transform");
+    auto calls = make_shared<int>(0);
+    auto square = [=](int i){++*calls; return i * i;};
+    auto squares = make_shared<vector<int>>();
+    ints(0, 999) |
+        transform([](int i){return i % 10;}) |
+        memoize_transform(square, 16) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](int v){squares->push_back(v);});
+        }) |
+        start();
+    expect(*calls == 10 && squares->size() == 1000 && (*squares)[997] == 49, "memoize_transform calls f once for each repeated value");
+
+    *calls = 0;
+    ints(0, 99) |
+        memoize_transform(square, 16) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [](int){});
+        }) |
+        start();
+    expect(*calls == 100, "memoize_transform calls f for each value that is not cached");
+
+    *calls = 0;
+    memoize_cache<int, int> shared(64, 4);
+    for (int pass = 0; pass < 2; ++pass) {
+        // three quarters of the capacity, the shards are filled by hash
+        ints(0, 47) |
+            memoize_transform(square, shared) |
+            make_subscriber([=](auto ctx){
+                return make_observer(ctx.lifetime, [](int){});
+            }) |
+            start();
+    }
+    int cached = 0;
+    expect(*calls == 48 && shared.find(7, cached) && cached == 49, "memoize_transform shares a cache across subscriptions, the shards hold the capacity");
+
+    for (int k : {5, 12, 20}) {
+        // identity hashes of multiples of 2^k have the same low bits
+        *calls = 0;
+        memoize_cache<int, int> strided(64, 4);
+        for (int pass = 0; pass < 2; ++pass) {
+            ints(0, 31) |
+                transform([=](int i){return i << k;}) |
+                memoize_transform([=](int i){++*calls; return i >> k;}, strided) |
+                make_subscriber([=](auto ctx){
+                    return make_observer(ctx.lifetime, [](int){});
+                }) |
+                start();
+        }
+        expect(*calls == 32, "memoize_cache spreads keys that are multiples of 2^" + to_string(k) + " across its shards - " + to_string(*calls - 32) + " misses on the second pass");
+    }
+}
+cout << endl;
+#endif
+
+#if !RX_SKIP_TESTS
+{
+ output("combine_locally");
+    auto sums = make_shared<map<int, int>>();
+    auto flushes = make_shared<int>(0);
+    ints(1, 100) |
+        combine_locally([](int i){return i % 3;}, [](int partial, int i){return partial + i;}, combine_flush_policy{2}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](pair<int, int> p){
+                (*sums)[p.first] += p.second;
+                ++*flushes;
+            });
+        }) |
+        start();
+    expect(*sums == map<int, int>{{0, 1683}, {1, 1717}, {2, 1650}} && *flushes > 3, "combine_locally emits partials that add up to the totals of each key");
+
+    auto base = steady_clock::now();
+    auto partials = make_shared<vector<long>>();
+    auto first = make_shared<steady_clock::time_point>();
+    intervals(make_new_thread<>{}, base, 200ms) |
+        take(2) |
+        combine_locally(makeThread, [](long){return 0;}, [](long partial, long i){return partial + i;},
+            combine_flush_policy{1024, numeric_limits<size_t>::max(), 30ms}) |
+        make_subscriber([=](auto ctx){
+            return make_observer(ctx.lifetime, [=](pair<int, long> p){
+                if (partials->empty()) {
+                    *first = steady_clock::now();
+                }
+                partials->push_back(p.second + 1);
+            });
+        }) |
+        start() |
+        join();
+    this_thread::sleep_for(100ms);
+    expect(*partials == vector<long>{1, 2} && *first - base < 150ms, "combine_locally flushes a table from a timer once its first value is max_age old");
+}
+cout << endl;
+#endif
+
 #endif 
 
 #if !RX_INFO && !RX_SKIP_TESTS
@@ -0,0 +1,205 @@
+#pragma once
+
+namespace rx {
+
+/// \brief target is the acceptable time from the arrival of the first value
+/// in a batch until the batch has been delivered.
+/// the batch size grows by increase after each full batch that met the target
+/// and is multiplied by decrease after each batch that missed the target.
+struct adaptive_batch_policy
+{
+    explicit adaptive_batch_policy(steady_clock::duration target = 10ms, size_t min_size = 1, size_t max_size = 4096, size_t increase = 1, double decrease = 0.5)
+        : target(target)
+        , min_size(min_size)
+        , max_size(max_size)
+        , increase(increase)
+        , decrease(decrease) {
+    }
+    steady_clock::duration target;
+    size_t min_size;
+    size_t max_size;
+    size_t increase;
+    double decrease;
+};
+
+namespace detail {
+
+/// \brief AIMD control of the batch size.
+/// the flush interval is the part of the target that is not used to process a batch.
+template<class Clock>
+struct batch_controller
+{
+    using clock_type = decay_t<Clock>;
+    using duration_type = duration_t<clock_type>;
+
+    explicit batch_controller(const adaptive_batch_policy& p)
+        : policy(p)
+        , target(duration_cast<duration_type>(p.target))
+        , size(p.min_size)
+        , flush(target)
+        , processing(duration_type::zero()) {
+    }
+
+    adaptive_batch_policy policy;
+    duration_type target;
+    size_t size;
+    duration_type flush;
+    duration_type processing;
+
+    void update(bool full, duration_type latency, duration_type elapsed) {
+        processing = (processing * 7 + elapsed) / 8;
+        if (latency > target) {
+            size = max(policy.min_size, static_cast<size_t>(size * policy.decrease));
+        } else if (full) {
+            size = min(policy.max_size, size + policy.increase);
+        }
+        flush = target > processing ? target - processing : duration_type::zero();
+    }
+};
+
+template<class Value, class Clock>
+struct batch_buffer
+{
+    batch_buffer() : generation(0), bound(false) {}
+    vector<Value> values;
+    time_point_t<Clock> first;
+    long generation;
+    /// the drain for this buffer is bound
+    bool bound;
+};
+
+template<class Clock>
+struct adaptive_batch_state
+{
+    explicit adaptive_batch_state(const adaptive_batch_policy& p) : controller(p) {}
+    mutex lock;
+    batch_controller<Clock> controller;
+    /// batch_buffer<Value, Clock> for each value type
+    late_bound buffer;
+    /// deliver the partial batches, one bound with each buffer type
+    vector<function<void()>> drain;
+};
+
+}
+
+/// \brief collects values into vector batches that are delivered on the strand from makeStrand.
+/// a batch is delivered when it reaches the current batch size or when the flush interval
+/// has passed since its first value. both adapt to keep the batch latency, measured with
+/// the strand's now() from the first value until the batch has been processed, 
+/// under policy.target while making batches as large as possible.
+/// values of different types are collected into separate batches.
+template<class MakeStrand>
+auto adaptive_batch(MakeStrand makeStrand, adaptive_batch_policy policy = adaptive_batch_policy{}){
+    info("new adaptive_batch");
+    return make_lifter([=](auto scbr){
+        info("adaptive_batch bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("adaptive_batch bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto outcontext = copy_context(ctx.lifetime, makeStrand, ctx);
+            auto r = scbr.create(outcontext);
+            using clock_type = clock_t<decltype(outcontext)>;
+            using time_point_type = time_point_t<clock_type>;
+            auto batching = make_state<detail::adaptive_batch_state<clock_type>>(ctx.lifetime, policy);
+            auto& batch = batching.get();
+            ctx.lifetime.insert([&batch](){
+                // drain holds the state
+                unique_lock<mutex> guard(batch.lock);
+                batch.drain.clear();
+            });
+
+            // called on the strand
+            // the time spent waiting for the strand is not part of the
+            // latency since the batch size does not control it.
+            auto deliver = [=](auto& r, auto& values, time_point_type first, time_point_type closed, bool full){
+                auto start = outcontext.now();
+                r.next(move(values));
+                auto end = outcontext.now();
+                auto& s = batching.get();
+                unique_lock<mutex> guard(s.lock);
+                s.controller.update(full, (closed - first) + (end - start), end - start);
+            };
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    using value_type = decay_t<decltype(v)>;
+                    using buffer_type = detail::batch_buffer<value_type, clock_type>;
+                    auto& s = batching.get();
+                    unique_lock<mutex> guard(s.lock);
+                    auto& buffer = s.buffer.template get<buffer_type>();
+                    if (!buffer.bound) {
+                        buffer.bound = true;
+                        s.drain.push_back([=](){
+                            auto& s = batching.get();
+                            unique_lock<mutex> guard(s.lock);
+                            auto& buffer = s.buffer.template get<buffer_type>();
+                            auto values = move(buffer.values);
+                            auto first = buffer.first;
+                            ++buffer.generation;
+                            guard.unlock();
+                            if (!values.empty()) {
+                                deliver(r, values, first, outcontext.now(), false);
+                            }
+                        });
+                    }
+                    if (buffer.values.empty()) {
+                        buffer.first = outcontext.now();
+                        auto generation = ++buffer.generation;
+                        auto flush = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                            auto& s = batching.get();
+                            unique_lock<mutex> guard(s.lock);
+                            auto& buffer = s.buffer.template get<buffer_type>();
+                            if (buffer.generation != generation || buffer.values.empty()) {
+                                return;
+                            }
+                            auto values = move(buffer.values);
+                            auto first = buffer.first;
+                            ++buffer.generation;
+                            buffer.values.reserve(s.controller.size);
+                            guard.unlock();
+                            deliver(r, values, first, outcontext.now(), false);
+                        }, detail::pass{}, detail::skip{});
+                        defer_at(outcontext, buffer.first + s.controller.flush, flush);
+                    }
+                    buffer.values.push_back(move(v));
+                    if (buffer.values.size() < s.controller.size) {
+                        return;
+                    }
+                    auto values = move(buffer.values);
+                    auto first = buffer.first;
+                    auto closed = outcontext.now();
+                    ++buffer.generation;
+                    buffer.values.reserve(s.controller.size);
+                    guard.unlock();
+                    auto full = make_observer(r, subscription{}, [=](auto& r, auto& ) mutable {
+                        deliver(r, values, first, closed, true);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, full);
+                },
+                [=](auto& r, auto e){
+                    auto error = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        auto& s = batching.get();
+                        unique_lock<mutex> guard(s.lock);
+                        auto drain = s.drain;
+                        guard.unlock();
+                        for (auto& d : drain) d();
+                        r.error(e);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, error);
+                },
+                [=](auto& r){
+                    auto complete = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        auto& s = batching.get();
+                        unique_lock<mutex> guard(s.lock);
+                        auto drain = s.drain;
+                        guard.unlock();
+                        for (auto& d : drain) d();
+                        r.complete();
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, complete);
+                });
+        });
+    });
+}
+
+}
@@ -0,0 +1,565 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+class checkpoint_error : public runtime_error {
+public:
+  explicit checkpoint_error (const string& what_arg) : runtime_error(what_arg) {}
+  explicit checkpoint_error (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+namespace detail {
+
+/// \brief writes a snapshot to fd through a buffer, so that a snapshot is never
+/// held in memory as a whole.
+class checkpoint_file
+{
+public:
+    checkpoint_file(int fd, string path)
+        : fd(fd)
+        , path(move(path))
+        , flushed(0) {
+        buffer.reserve(capacity);
+    }
+
+    void put(uint64_t n) {
+        bytes(&n, sizeof(n));
+    }
+    void put(const string& s) {
+        put(s.size());
+        bytes(s.data(), s.size());
+    }
+    template<class Serializer, class V>
+    void put(const Serializer& serializer, const V& v) {
+        auto size = serializer.size(v);
+        put(size);
+        if (buffer.size() + size > capacity) {
+            flush();
+        }
+        auto at = buffer.size();
+        buffer.resize(at + size);
+        if (size > 0) {
+            serializer.save(v, &buffer[at]);
+        }
+    }
+
+    /// \brief starts a field of unknown size. \returns the position of its size.
+    uint64_t open_field() {
+        auto at = position();
+        put(uint64_t(0));
+        return at;
+    }
+    /// \brief writes the size of the field that open_field started.
+    void close_field(uint64_t at) {
+        uint64_t size = position() - at - sizeof(uint64_t);
+        if (at >= flushed) {
+            memcpy(&buffer[static_cast<size_t>(at - flushed)], &size, sizeof(size));
+            return;
+        }
+        if (::pwrite(fd, &size, sizeof(size), static_cast<off_t>(at)) != static_cast<ssize_t>(sizeof(size))) {
+            throw system_error(errno, system_category(), "checkpoint write " + path);
+        }
+    }
+
+    void flush() {
+        size_t written = 0;
+        while (written < buffer.size()) {
+            auto count = ::pwrite(fd, buffer.data() + written, buffer.size() - written, static_cast<off_t>(flushed + written));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0) {
+                throw system_error(errno, system_category(), "checkpoint write " + path);
+            }
+            written += static_cast<size_t>(count);
+        }
+        flushed += buffer.size();
+        buffer.clear();
+    }
+
+private:
+    static const size_t capacity = 1024 * 1024;
+
+    uint64_t position() const {
+        return flushed + buffer.size();
+    }
+    void bytes(const void* data, size_t size) {
+        if (buffer.size() + size > capacity) {
+            flush();
+        }
+        buffer.append(static_cast<const char*>(data), size);
+    }
+
+    int fd;
+    string path;
+    string buffer;
+    uint64_t flushed;
+};
+
+/// \brief reads the fields that checkpoint_file wrote
+struct checkpoint_reader
+{
+    checkpoint_reader(const char* first, const char* last) : at(first), last(last) {}
+    const char* at;
+    const char* last;
+
+    uint64_t number() {
+        uint64_t n;
+        bytes(&n, sizeof(n));
+        return n;
+    }
+    /// \returns the size and the position of the next field
+    pair<const char*, size_t> field() {
+        auto size = number();
+        if (size > static_cast<uint64_t>(last - at)) {
+            throw checkpoint_error("checkpoint is truncated");
+        }
+        auto first = at;
+        at += size;
+        return make_pair(first, static_cast<size_t>(size));
+    }
+    void bytes(void* out, size_t size) {
+        if (size > static_cast<size_t>(last - at)) {
+            throw checkpoint_error("checkpoint is truncated");
+        }
+        memcpy(out, at, size);
+        at += size;
+    }
+    bool done() const {
+        return at == last;
+    }
+};
+
+/// \brief a file that is removed with the last reference to it
+struct checkpoint_scratch
+{
+    explicit checkpoint_scratch(string path) : path(move(path)) {}
+    ~checkpoint_scratch() {
+        ::unlink(path.c_str());
+    }
+    string path;
+};
+
+}
+
+/// \brief saves the state of operators to a file and restores it after a restart.
+///
+/// the operators track their make_state and keyed store states by name. take()
+/// is called on the strand of the operators. a make_state value and a
+/// memory_keyed_store are copied there, a mmap_keyed_store is flushed and its
+/// file is copied by the kernel (see mmap_keyed_store::copy_to). the copies are
+/// then serialized and streamed to the file on the io threads, so the strand
+/// does not wait for the disk. each snapshot replaces the file at path atomically,
+/// with the offset of the input that it includes. a pipeline that restarts from
+/// a snapshot replays its input from offset(). the snapshot that is restored is
+/// mapped, not read into memory.
+class checkpoint
+{
+public:
+    checkpoint(string path, shared_ptr<file_io> io)
+        : io(move(io))
+        , restored(0)
+        , registry(make_shared<tracking>())
+        , writer(make_shared<writing>(move(path)))
+        , mapped(nullptr)
+        , mapped_size(0) {
+        load();
+    }
+    /// waits for the snapshots that were taken, unless it runs in a done callback
+    /// of this checkpoint, on the io thread that writes them
+    ~checkpoint() {
+        {
+            unique_lock<mutex> guard(writer->lock);
+            if (writer->io_thread != this_thread::get_id()) {
+                writer->idle.wait(guard, [this](){return !writer->busy;});
+            }
+        }
+        if (mapped) {
+            ::munmap(mapped, mapped_size);
+        }
+    }
+    checkpoint(const checkpoint&) = delete;
+    checkpoint& operator=(const checkpoint&) = delete;
+
+    /// the offset of the input in the snapshot that was restored, 0 without a snapshot
+    uint64_t offset() const {
+        return restored;
+    }
+
+    /// \brief tracks the state s under name and restores it from the snapshot.
+    /// serializer stores the value of the state, see spill_serializer.
+    template<class T, class Serializer = spill_serializer>
+    void track(string name, state<T> s, Serializer serializer = Serializer{}) {
+        auto found = parts.find(name);
+        if (found != parts.end()) {
+            s.get() = serializer.template load<T>(found->second.first, found->second.second);
+        }
+        add(move(name), s.lifetime, [s, serializer]() -> part_writer {
+            auto copy = make_shared<T>(s.get());
+            return [copy, serializer](detail::checkpoint_file& out){
+                out.put(serializer, *copy);
+            };
+        });
+    }
+
+    /// \brief tracks the entries of the keyed store s under name and restores them from the snapshot.
+    /// serializer stores the keys and the values, see spill_serializer.
+    template<class Key, class Value, class Hash, class Serializer = spill_serializer>
+    void track(string name, state<memory_keyed_store<Key, Value, Hash>> s, Serializer serializer = Serializer{}) {
+        restore_keyed<Key, Value>(name, s, serializer);
+        add(move(name), s.lifetime, [s, serializer]() -> part_writer {
+            // one copy of the dense entries, the entries are serialized on the io thread
+            auto copy = make_shared<memory_keyed_store<Key, Value, Hash>>(s.get());
+            return [copy, serializer](detail::checkpoint_file& out){
+                write_keyed<Key, Value>(out, *copy, serializer);
+            };
+        });
+    }
+    template<class Key, class Value, class Hash, class Serializer = spill_serializer>
+    void track(string name, state<mmap_keyed_store<Key, Value, Hash>> s, Serializer serializer = Serializer{}) {
+        using store_type = mmap_keyed_store<Key, Value, Hash>;
+        restore_keyed<Key, Value>(name, s, serializer);
+        auto registry = this->registry;
+        auto path = writer->path;
+        add(move(name), s.lifetime, [s, serializer, registry, path]() -> part_writer {
+            auto copy = make_shared<detail::checkpoint_scratch>(path + ".store" + to_string(registry->next_scratch++));
+            s.get().copy_to(copy->path);
+            return [copy, serializer](detail::checkpoint_file& out){
+                store_type entries(mmap_store_options{copy->path, 2, 1});
+                write_keyed<Key, Value>(out, entries, serializer);
+            };
+        });
+    }
+
+    /// \brief takes a snapshot of the tracked states that includes the input up to offset.
+    /// done is called on an io thread once the snapshot is written. when a snapshot
+    /// is still being written, the new snapshot waits for it and replaces a snapshot
+    /// that was waiting before it.
+    void take(uint64_t offset, function<void(exception_ptr)> done = nullptr) {
+        auto s = make_shared<snapshot>();
+        s->offset = offset;
+        {
+            unique_lock<mutex> guard(registry->lock);
+            for (auto& p : registry->tracked) {
+                s->parts.emplace_back(p.second.first, p.second.second());
+            }
+        }
+        if (done) {
+            s->done.push_back(move(done));
+        }
+        unique_lock<mutex> guard(writer->lock);
+        if (writer->busy) {
+            if (writer->pending) {
+                s->done.insert(s->done.begin(), writer->pending->done.begin(), writer->pending->done.end());
+            }
+            writer->pending = s;
+            return;
+        }
+        writer->busy = true;
+        guard.unlock();
+        start(writer, io, s);
+    }
+
+    /// \brief waits until the snapshots that were taken are written
+    void wait() {
+        unique_lock<mutex> guard(writer->lock);
+        writer->idle.wait(guard, [this](){return !writer->busy;});
+    }
+
+private:
+    using part_writer = function<void(detail::checkpoint_file&)>;
+    using capture = function<part_writer()>;
+
+    /// the states that are tracked, released with their operators
+    struct tracking
+    {
+        tracking() : next_id(0), next_scratch(0) {}
+        mutex lock;
+        uint64_t next_id;
+        map<uint64_t, pair<string, capture>> tracked;
+        /// names the copies of the mmap stores
+        atomic<uint64_t> next_scratch;
+    };
+
+    struct snapshot
+    {
+        uint64_t offset;
+        vector<pair<string, part_writer>> parts;
+        vector<function<void(exception_ptr)>> done;
+    };
+
+    /// the snapshots that the io threads write, shared with the io job so that the
+    /// checkpoint may be released on any thread
+    struct writing
+    {
+        explicit writing(string path) : path(move(path)), busy(false) {}
+        string path;
+        mutex lock;
+        condition_variable idle;
+        bool busy;
+        shared_ptr<snapshot> pending;
+        /// the io thread that is writing
+        thread::id io_thread;
+    };
+
+    /// a store that keeps its entries (mmap_keyed_store) is replaced by the snapshot
+    template<class Key, class Value, class Store, class Serializer>
+    void restore_keyed(const string& name, state<Store> s, const Serializer& serializer) {
+        auto found = parts.find(name);
+        if (found == parts.end()) {
+            return;
+        }
+        vector<Key> stale;
+        s.get().for_each([&](const Key& k, Value& ){
+            stale.push_back(k);
+        });
+        for (auto& k : stale) {
+            s.get().erase(k);
+        }
+        detail::checkpoint_reader in(found->second.first, found->second.first + found->second.second);
+        while (!in.done()) {
+            auto k = in.field();
+            auto v = in.field();
+            s.get().get(serializer.template load<Key>(k.first, k.second)) = serializer.template load<Value>(v.first, v.second);
+        }
+    }
+
+    template<class Key, class Value, class Store, class Serializer>
+    static void write_keyed(detail::checkpoint_file& out, Store& store, const Serializer& serializer) {
+        auto at = out.open_field();
+        store.for_each([&](const Key& k, Value& v){
+            out.put(serializer, k);
+            out.put(serializer, v);
+        });
+        out.close_field(at);
+    }
+
+    void add(string name, subscription lifetime, capture c) {
+        unique_lock<mutex> guard(registry->lock);
+        auto id = registry->next_id++;
+        registry->tracked.emplace(id, make_pair(move(name), move(c)));
+        guard.unlock();
+        weak_ptr<tracking> weak = registry;
+        lifetime.insert([weak, id](){
+            auto registry = weak.lock();
+            if (registry) {
+                unique_lock<mutex> guard(registry->lock);
+                registry->tracked.erase(id);
+            }
+        });
+    }
+
+    static void start(shared_ptr<writing> w, const shared_ptr<file_io>& io, shared_ptr<snapshot> s) {
+        io->submit([w, s](){
+            auto current = s;
+            for (;;) {
+                {
+                    unique_lock<mutex> guard(w->lock);
+                    w->io_thread = this_thread::get_id();
+                }
+                exception_ptr error;
+                try {
+                    write(w->path, *current);
+                } catch(...) {
+                    error = current_exception();
+                }
+                // done may release the checkpoint, which then does not wait for this thread
+                for (auto& d : current->done) {
+                    d(error);
+                }
+                unique_lock<mutex> guard(w->lock);
+                w->io_thread = thread::id{};
+                if (!w->pending) {
+                    w->busy = false;
+                    w->idle.notify_all();
+                    return;
+                }
+                current = move(w->pending);
+                w->pending.reset();
+            }
+        });
+    }
+
+    static uint64_t magic() {
+        return 0x7278636b70743031ull;
+    }
+
+    /// the file is streamed next to path and renamed over it once it is on the disk,
+    /// then the directory is synced so that the rename is on the disk too
+    static void write(const string& path, const snapshot& s) {
+        auto temporary = path + ".tmp";
+        auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw system_error(errno, system_category(), "checkpoint open " + temporary);
+        }
+        try {
+            detail::checkpoint_file out(fd, temporary);
+            out.put(magic());
+            out.put(s.offset);
+            out.put(s.parts.size());
+            for (auto& p : s.parts) {
+                out.put(p.first);
+                p.second(out);
+            }
+            out.flush();
+            if (::fsync(fd) != 0) {
+                throw system_error(errno, system_category(), "checkpoint sync " + temporary);
+            }
+        } catch(...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        if (::rename(temporary.c_str(), path.c_str()) != 0) {
+            throw system_error(errno, system_category(), "checkpoint rename " + temporary);
+        }
+        auto slash = path.rfind('/');
+        auto directory = slash == string::npos ? string(".") : path.substr(0, max<size_t>(slash, 1));
+        auto dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir < 0) {
+            throw system_error(errno, system_category(), "checkpoint open " + directory);
+        }
+        auto synced = ::fsync(dir);
+        auto e = errno;
+        ::close(dir);
+        if (synced != 0) {
+            throw system_error(e, system_category(), "checkpoint sync " + directory);
+        }
+    }
+
+    void load() {
+        auto& path = writer->path;
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                return;
+            }
+            throw system_error(errno, system_category(), "checkpoint open " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            auto e = errno;
+            ::close(fd);
+            throw system_error(e, system_category(), "checkpoint stat " + path);
+        }
+        if (info.st_size == 0) {
+            ::close(fd);
+            throw checkpoint_error("checkpoint " + path + " is not a checkpoint");
+        }
+        auto memory = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        auto e = errno;
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+            throw system_error(e, system_category(), "checkpoint map " + path);
+        }
+        mapped = memory;
+        mapped_size = static_cast<size_t>(info.st_size);
+        try {
+            auto data = static_cast<const char*>(mapped);
+            detail::checkpoint_reader in(data, data + mapped_size);
+            if (in.number() != magic()) {
+                throw checkpoint_error("checkpoint " + path + " is not a checkpoint");
+            }
+            restored = in.number();
+            auto count = in.number();
+            for (uint64_t i = 0; i < count; ++i) {
+                auto name = in.field();
+                auto part = in.field();
+                parts[string(name.first, name.second)] = part;
+            }
+        } catch(...) {
+            ::munmap(mapped, mapped_size);
+            mapped = nullptr;
+            throw;
+        }
+    }
+
+    shared_ptr<file_io> io;
+    uint64_t restored;
+    /// the states in the snapshot that was restored, in the mapping of the file
+    map<string, pair<const char*, size_t>> parts;
+    shared_ptr<tracking> registry;
+    shared_ptr<writing> writer;
+    void* mapped;
+    size_t mapped_size;
+};
+
+inline shared_ptr<checkpoint> make_checkpoint(string path, shared_ptr<file_io> io) {
+    return make_shared<checkpoint>(move(path), move(io));
+}
+
+namespace detail {
+
+/// the first error of the snapshots of a checkpoint_every, set on the io threads
+struct checkpoint_failure
+{
+    mutex lock;
+    exception_ptr error;
+
+    exception_ptr get() {
+        unique_lock<mutex> guard(lock);
+        return error;
+    }
+    void set(exception_ptr e) {
+        unique_lock<mutex> guard(lock);
+        if (!error) {
+            error = e;
+        }
+    }
+};
+
+}
+
+/// \brief passes each value on and takes a snapshot of cp after every count values.
+/// the offset of the snapshot is cp->offset() plus the number of values that passed,
+/// so the source restarts from cp->offset(). the states of the operators after
+/// checkpoint_every must be updated on the same strand, before the value returns.
+/// a snapshot that fails is delivered to error with the next value, complete waits
+/// for the snapshots to be written and delivers a failure instead of completing.
+inline auto checkpoint_every(shared_ptr<checkpoint> cp, uint64_t count){
+    info("new checkpoint_every");
+    return make_lifter([=](auto scbr){
+        info("checkpoint_every bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("checkpoint_every bound to context");
+            auto r = scbr.create(ctx);
+            auto passed = make_state<uint64_t>(ctx.lifetime, 0);
+            auto failure = make_shared<detail::checkpoint_failure>();
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto v){
+                    if (auto e = failure->get()) {
+                        r.error(e);
+                        return;
+                    }
+                    r.next(move(v));
+                    auto& n = passed.get();
+                    if (++n % max<uint64_t>(count, 1) == 0) {
+                        try {
+                            cp->take(cp->offset() + n, [failure](exception_ptr e){
+                                if (e) {
+                                    failure->set(e);
+                                }
+                            });
+                        } catch(...) {
+                            r.error(current_exception());
+                        }
+                    }
+                },
+                detail::pass{},
+                [=](auto& r){
+                    cp->wait();
+                    if (auto e = failure->get()) {
+                        r.error(e);
+                        return;
+                    }
+                    r.complete();
+                });
+        });
+    });
+}
+
+#endif
+
+}
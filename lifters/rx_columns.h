@@ -0,0 +1,149 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+/// \brief narrows the selection of batch to the rows where pred(value) is true for field I.
+/// null values are never selected. the loops append each row and advance
+/// the output by the result of pred, so there is no branch on the predicate.
+template<size_t I, class Batch, class Pred>
+void select_rows(Batch& batch, const Pred& pred) {
+    const auto& c = get_column<I>(batch);
+    const auto& values = c.all();
+    vector<uint32_t> selection(batch.size());
+    size_t count = 0;
+    if (batch.selected) {
+        for (auto row : batch.selection) {
+            selection[count] = row;
+            count += (c.is_valid(row) && pred(values[row])) ? 1 : 0;
+        }
+    } else if (c.null_count() == 0) {
+        for (size_t row = 0; row < batch.rows; ++row) {
+            selection[count] = static_cast<uint32_t>(row);
+            count += pred(values[row]) ? 1 : 0;
+        }
+    } else {
+        for (size_t row = 0; row < batch.rows; ++row) {
+            selection[count] = static_cast<uint32_t>(row);
+            count += (c.is_valid(row) && pred(values[row])) ? 1 : 0;
+        }
+    }
+    selection.resize(count);
+    batch.selection = move(selection);
+    batch.selected = true;
+}
+
+/// the fields that are read by transform_column, field I when none are listed
+template<size_t I, size_t... Sn>
+struct column_sources
+{
+    using type = index_sequence<Sn...>;
+};
+template<size_t I>
+struct column_sources<I>
+{
+    using type = index_sequence<I>;
+};
+
+/// \brief evaluates f over whole columns and replaces field I with the result.
+/// f is called for every row, including null and unselected rows, so that the
+/// loop is a straight pass over contiguous arrays.
+template<size_t I, size_t S, size_t... Sn, class Batch, class F>
+auto evaluate_column(Batch&& batch, const F& f, index_sequence<S, Sn...>) {
+    using result_type = decay_t<decltype(f(get_column<S>(batch).all()[0], get_column<Sn>(batch).all()[0]...))>;
+    vector<result_type> values(batch.rows);
+    for (size_t row = 0; row < batch.rows; ++row) {
+        values[row] = f(get_column<S>(batch).all()[row], get_column<Sn>(batch).all()[row]...);
+    }
+    auto result = get_column<S>(batch).with_values(move(values));
+    int unpack[] = {0, (result.intersect_validity(get_column<Sn>(batch)), 0)...};
+    (void)unpack;
+    return replace_column<I>(move(batch), move(result));
+}
+
+/// \brief folds the valid values of field I in the selected rows of batch into acc
+template<size_t I, class Batch, class Acc, class Op>
+void fold_column(const Batch& batch, Acc& acc, const Op& op) {
+    const auto& c = get_column<I>(batch);
+    const auto& values = c.all();
+    if (!batch.selected && c.null_count() == 0) {
+        for (size_t row = 0; row < batch.rows; ++row) {
+            acc = op(move(acc), values[row]);
+        }
+        return;
+    }
+    batch.for_each_row([&](size_t row){
+        if (c.is_valid(row)) {
+            acc = op(move(acc), values[row]);
+        }
+    });
+}
+
+}
+
+/// \brief filters each record_batch by pred(value) over field I.
+/// the columns are not copied, the selection of the batch is narrowed instead.
+/// batches with no selected rows are not emitted.
+template<size_t I, class Pred>
+auto copy_if_column(Pred pred){
+    info("new copy_if_column");
+    return make_lifter([=](auto scbr){
+        info("copy_if_column bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("copy_if_column bound to context");
+            auto r = scbr.create(ctx);
+            return make_observer(r, r.lifetime, [=](auto& r, auto batch){
+                detail::select_rows<I>(batch, pred);
+                if (!batch.empty()) {
+                    r.next(move(batch));
+                }
+            });
+        });
+    });
+}
+
+/// \brief replaces field I of each record_batch with f applied to the fields Sn (or to field I
+/// when no fields are listed). the type of field I becomes the result type of f.
+/// f is called for every row, including null and unselected rows. a row is null in
+/// the result when it is null in any of the fields passed to f.
+template<size_t I, size_t... Sn, class F>
+auto transform_column(F f){
+    info("new transform_column");
+    return make_lifter([=](auto scbr){
+        info("transform_column bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("transform_column bound to context");
+            auto r = scbr.create(ctx);
+            return make_observer(r, r.lifetime, [=](auto& r, auto batch){
+                r.next(detail::evaluate_column<I>(move(batch), f, typename detail::column_sources<I, Sn...>::type{}));
+            });
+        });
+    });
+}
+
+/// \brief folds the valid values of field I in the selected rows of every record_batch.
+/// acc = op(acc, value) starting from seed. emits acc when the source completes.
+template<size_t I, class Seed, class Op>
+auto reduce_column(Seed seed, Op op){
+    info("new reduce_column");
+    return make_lifter([=](auto scbr){
+        info("reduce_column bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("reduce_column bound to context");
+            auto r = scbr.create(ctx);
+            auto acc = make_state<Seed>(ctx.lifetime, seed);
+            return make_observer(r, r.lifetime,
+                [=](auto& , auto& batch){
+                    detail::fold_column<I>(batch, acc.get(), op);
+                },
+                detail::pass{},
+                [=](auto& r){
+                    r.next(acc.get());
+                    r.complete();
+                });
+        });
+    });
+}
+
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+namespace rx {
+
+/// \brief when combine_locally emits its partial aggregates.
+/// the table is flushed when it holds max_keys keys, when max_values values were
+/// combined into it or once max_age has passed since the first value in the table.
+/// without a timer strand max_age is checked only when a value arrives.
+/// max_keys should keep the table in the cache.
+struct combine_flush_policy
+{
+    explicit combine_flush_policy(size_t max_keys = 1024, size_t max_values = numeric_limits<size_t>::max(), steady_clock::duration max_age = 10ms)
+        : max_keys(max<size_t>(max_keys, 1))
+        , max_values(max<size_t>(max_values, 1))
+        , max_age(max_age) {
+    }
+    size_t max_keys;
+    size_t max_values;
+    steady_clock::duration max_age;
+};
+
+namespace detail {
+
+template<class Key, class Value, class Clock>
+struct combine_table
+{
+    explicit combine_table(size_t max_keys)
+        : partials(max_keys * 2)
+        , values(0)
+        , bound(false)
+        , timer(false) {
+    }
+    memory_keyed_store<Key, Value> partials;
+    size_t values;
+    time_point_t<Clock> first;
+    /// flush is bound
+    bool bound;
+    /// a max_age timer is pending
+    bool timer;
+};
+
+struct combine_state
+{
+    /// held for each value when there is a timer, which flushes from its own strand.
+    /// the partials are emitted under it, a consumer that stops takes it again.
+    recursive_mutex lock;
+    /// combine_table<Key, Value, Clock> for each value type
+    late_bound table;
+    /// emit the partial aggregates before complete or error, one bound with each table type
+    vector<function<void()>> flush;
+};
+
+template<class Observer, class Table>
+void combine_flush(const Observer& r, Table& t) {
+    t.partials.for_each([&](const auto& k, auto& partial){
+        if (!r.lifetime.is_stopped()) {
+            r.next(make_pair(k, move(partial)));
+        }
+    });
+    t.partials.clear();
+    t.values = 0;
+}
+
+/// max_age is checked when a value arrives
+struct combine_untimed {};
+
+/// \returns the context of the timer strand, the context of the producer without one
+template<class Context>
+Context combine_timer(const combine_untimed&, const Context& ctx) {
+    return ctx;
+}
+template<class MakeStrand, class Context>
+auto combine_timer(const MakeStrand& makeStrand, const Context& ctx) {
+    return copy_context(ctx.lifetime, makeStrand, ctx);
+}
+
+template<class TimerContext, class TimePoint, class Expired>
+void combine_schedule(false_type, const TimerContext& , TimePoint , Expired ) {
+}
+template<class TimerContext, class TimePoint, class Expired>
+void combine_schedule(true_type, const TimerContext& timercontext, TimePoint at, Expired expired) {
+    defer_at(timercontext, at, expired);
+}
+
+template<class Timer, class KeyFn, class CombineFn>
+auto make_combine_locally(Timer timer, KeyFn key, CombineFn combine, combine_flush_policy policy){
+    using timed_type = integral_constant<bool, !is_same<Timer, combine_untimed>::value>;
+    static const bool timed = timed_type::value;
+    return make_lifter([=](auto scbr){
+        info("combine_locally bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("combine_locally bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto r = scbr.create(ctx);
+            using clock_type = clock_t<decltype(ctx)>;
+            auto timercontext = combine_timer(timer, ctx);
+            auto combining = make_state<combine_state>(ctx.lifetime);
+            auto& state = combining.get();
+            ctx.lifetime.insert([&state](){
+                // flush holds the state
+                unique_lock<recursive_mutex> guard(state.lock);
+                state.flush.clear();
+            });
+            auto age = duration_cast<duration_t<clock_type>>(policy.max_age);
+            auto finish = [=](){
+                auto& s = combining.get();
+                unique_lock<recursive_mutex> guard(s.lock);
+                // a consumer that stops clears flush
+                auto flush = s.flush;
+                for (auto& f : flush) f();
+            };
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    using key_type = decay_t<decltype(key(v))>;
+                    using value_type = decay_t<decltype(v)>;
+                    using table_type = combine_table<key_type, value_type, clock_type>;
+                    auto& s = combining.get();
+                    unique_lock<recursive_mutex> guard(s.lock, defer_lock);
+                    if (timed) {
+                        guard.lock();
+                    }
+                    auto& t = s.table.template get<table_type>(policy.max_keys);
+                    if (!t.bound) {
+                        t.bound = true;
+                        unique_lock<recursive_mutex> bind(s.lock);
+                        s.flush.push_back([=](){
+                            combine_flush(r, combining.get().table.template get<table_type>(policy.max_keys));
+                        });
+                    }
+                    auto now = ctx.now();
+                    if (t.values == 0) {
+                        t.first = now;
+                        if (timed && !t.timer) {
+                            // runs on the timer strand, flushes the table once its first value is max_age old
+                            auto expire = [=](auto& r, auto& self){
+                                auto& s = combining.get();
+                                unique_lock<recursive_mutex> guard(s.lock);
+                                auto& t = s.table.template get<table_type>(policy.max_keys);
+                                t.timer = false;
+                                if (t.values == 0) {
+                                    return;
+                                }
+                                if (timercontext.now() - t.first >= age) {
+                                    combine_flush(r, t);
+                                    return;
+                                }
+                                t.timer = true;
+                                combine_schedule(timed_type{}, timercontext, t.first + age, make_observer(r, subscription{}, [=](auto& r, auto& ){
+                                    self(r, self);
+                                }, pass{}, skip{}));
+                            };
+                            t.timer = true;
+                            combine_schedule(timed_type{}, timercontext, t.first + age, make_observer(r, subscription{}, [=](auto& r, auto& ){
+                                expire(r, expire);
+                            }, pass{}, skip{}));
+                        }
+                    }
+                    auto k = key(v);
+                    auto partial = t.partials.find(k);
+                    if (partial) {
+                        *partial = combine(move(*partial), move(v));
+                    } else {
+                        t.partials.get(k) = move(v);
+                    }
+                    ++t.values;
+                    if (t.partials.size() >= policy.max_keys || t.values >= policy.max_values || now - t.first >= age) {
+                        combine_flush(r, t);
+                    }
+                },
+                [=](auto& r, auto e){
+                    finish();
+                    r.error(e);
+                },
+                [=](auto& r){
+                    finish();
+                    r.complete();
+                });
+        });
+    });
+}
+
+}
+
+/// \brief combines the values with the same key(v) on the strand of the producer,
+/// with combine(partial, v) -> partial, and emits pair(key, partial) for each key
+/// when the table is flushed (see combine_flush_policy) and before complete or error.
+/// the first value of a key is its partial, so the partial has the type of the
+/// values, which must be default constructible. to combine into another type,
+/// transform each value into a partial of that type first. combine must be
+/// associative, the consumer combines the partials of a key again, for example
+/// after observe_on. values of different types are combined in separate tables.
+///
+/// max_age is checked when a value arrives, a table that stops receiving values
+/// keeps its partials until complete or error.
+template<class KeyFn, class CombineFn>
+auto combine_locally(KeyFn key, CombineFn combine, combine_flush_policy policy = combine_flush_policy{}){
+    info("new combine_locally");
+    return detail::make_combine_locally(detail::combine_untimed{}, key, combine, policy);
+}
+
+/// \brief combines like combine_locally, and also flushes a table from a timer on the
+/// strand from makeStrand once max_age has passed since its first value, when no
+/// value arrives to flush it. the timer is scheduled when the table receives its
+/// first value. the table is then locked for each value, because the timer flushes
+/// from its own strand. makeStrand should queue its work, for example make_new_thread,
+/// an immediate strand would wait for the timer in the producer.
+template<class MakeStrand, class KeyFn, class CombineFn>
+auto combine_locally(MakeStrand makeStrand, KeyFn key, CombineFn combine, combine_flush_policy policy = combine_flush_policy{}){
+    info("new combine_locally");
+    return detail::make_combine_locally(makeStrand, key, combine, policy);
+}
+
+}
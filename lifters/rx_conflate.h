@@ -0,0 +1,166 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+/// selects a single slot for all values
+struct conflate_no_key {
+    template<class V>
+    conflate_no_key operator()(const V&) const {
+        return {};
+    }
+};
+
+/// \brief holds the latest value for each key that has not been delivered yet.
+/// pending is the dirty list in the order that each key was first updated.
+template<class Key, class Value>
+struct conflate_table
+{
+    conflate_table() : scheduled(false) {}
+    /// a drain is scheduled for this table
+    bool scheduled;
+    unordered_map<Key, size_t> index;
+    vector<Value> pending;
+    vector<Value> spare;
+
+    void update(Key&& k, Value&& v) {
+        auto slot = index.emplace(move(k), pending.size());
+        if (slot.second) {
+            pending.emplace_back(move(v));
+        } else {
+            pending[slot.first->second] = move(v);
+        }
+    }
+    vector<Value> exchange() {
+        index.clear();
+        auto values = move(pending);
+        pending = move(spare);
+        spare = vector<Value>{};
+        return values;
+    }
+    /// keeps the delivered allocation for the next exchange
+    void recycle(vector<Value>&& values) {
+        values.clear();
+        if (values.capacity() > spare.capacity()) {
+            spare = move(values);
+        }
+    }
+};
+
+template<class Value>
+struct conflate_table<conflate_no_key, Value>
+{
+    conflate_table() : scheduled(false) {}
+    bool scheduled;
+    vector<Value> pending;
+    vector<Value> spare;
+
+    void update(conflate_no_key&&, Value&& v) {
+        if (pending.empty()) {
+            pending.emplace_back(move(v));
+        } else {
+            pending.front() = move(v);
+        }
+    }
+    vector<Value> exchange() {
+        auto values = move(pending);
+        pending = move(spare);
+        spare = vector<Value>{};
+        return values;
+    }
+    void recycle(vector<Value>&& values) {
+        values.clear();
+        if (values.capacity() > spare.capacity()) {
+            spare = move(values);
+        }
+    }
+};
+
+struct conflate_state
+{
+    mutex lock;
+    /// conflate_table<Key, Value> for each value type
+    late_bound table;
+};
+
+template<class MakeStrand, class KeyFn>
+auto make_conflate(MakeStrand makeStrand, KeyFn key){
+    return make_lifter([=](auto scbr){
+        info("conflate bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("conflate bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto outcontext = copy_context(ctx.lifetime, makeStrand, ctx);
+            auto r = scbr.create(outcontext);
+            auto conflated = make_state<conflate_state>(ctx.lifetime);
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    using key_type = decay_t<decltype(key(v))>;
+                    using value_type = decay_t<decltype(v)>;
+                    auto& s = conflated.get();
+                    unique_lock<mutex> guard(s.lock);
+                    auto& t = s.table.template get<conflate_table<key_type, value_type>>();
+                    t.update(key_type(key(v)), move(v));
+                    if (t.scheduled) {
+                        return;
+                    }
+                    t.scheduled = true;
+                    guard.unlock();
+                    auto drain = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        auto& s = conflated.get();
+                        unique_lock<mutex> guard(s.lock);
+                        auto& t = s.table.template get<conflate_table<key_type, value_type>>();
+                        t.scheduled = false;
+                        auto values = t.exchange();
+                        guard.unlock();
+                        for (auto& v : values) {
+                            if (r.lifetime.is_stopped()) {
+                                return;
+                            }
+                            r.next(move(v));
+                        }
+                        guard.lock();
+                        t.recycle(move(values));
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, drain);
+                },
+                [=](auto& r, auto e){
+                    auto error = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        r.error(e);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, error);
+                },
+                [=](auto& r){
+                    auto complete = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        r.complete();
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, complete);
+                });
+        });
+    });
+}
+
+}
+
+/// \brief delivers values on the strand from makeStrand.
+/// while a delivery is pending only the most recent value is kept,
+/// so a slow consumer always receives the latest value instead of a backlog.
+/// when the source emits values of more than one type, the latest value of each type is kept.
+template<class MakeStrand>
+auto conflate(MakeStrand makeStrand){
+    info("new conflate");
+    return detail::make_conflate(makeStrand, detail::conflate_no_key{});
+}
+
+/// \brief delivers values on the strand from makeStrand.
+/// while a delivery is pending only the most recent value for each key(v) is kept.
+/// pending keys are delivered in the order they were first updated.
+template<class MakeStrand, class KeyFn>
+auto conflate_by_key(MakeStrand makeStrand, KeyFn key){
+    info("new conflate_by_key");
+    return detail::make_conflate(makeStrand, key);
+}
+
+}
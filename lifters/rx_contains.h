@@ -0,0 +1,204 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+/// \brief finds one pattern in text.
+/// candidates are positions where both the first and the last byte of the
+/// pattern match, they are found 32 (AVX2) or 16 (SSE2) positions at a time
+/// and only the candidates are compared with the whole pattern.
+class substring_search
+{
+public:
+    explicit substring_search(string pattern) : pattern(move(pattern)) {}
+
+    bool in(const char* text, size_t size) const {
+        auto m = pattern.size();
+        if (m == 0) {
+            return true;
+        }
+        if (size < m) {
+            return false;
+        }
+        auto p = pattern.data();
+        if (m == 1) {
+            return memchr(text, p[0], size) != nullptr;
+        }
+        // the positions where the pattern can start
+        auto positions = size - m + 1;
+        size_t i = 0;
+#if defined(__AVX2__)
+        const auto first = _mm256_set1_epi8(p[0]);
+        const auto last = _mm256_set1_epi8(p[m - 1]);
+        for (; i + 32 <= positions; i += 32) {
+            auto at_first = _mm256_cmpeq_epi8(first, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i)));
+            auto at_last = _mm256_cmpeq_epi8(last, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i + m - 1)));
+            auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(at_first, at_last)));
+            for (; mask != 0; mask &= mask - 1) {
+                auto at = i + count_trailing_zeros(mask);
+                if (memcmp(text + at + 1, p + 1, m - 2) == 0) {
+                    return true;
+                }
+            }
+        }
+#elif defined(__SSE2__)
+        const auto first = _mm_set1_epi8(p[0]);
+        const auto last = _mm_set1_epi8(p[m - 1]);
+        for (; i + 16 <= positions; i += 16) {
+            auto at_first = _mm_cmpeq_epi8(first, _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)));
+            auto at_last = _mm_cmpeq_epi8(last, _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + m - 1)));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(at_first, at_last)));
+            for (; mask != 0; mask &= mask - 1) {
+                auto at = i + count_trailing_zeros(mask);
+                if (memcmp(text + at + 1, p + 1, m - 2) == 0) {
+                    return true;
+                }
+            }
+        }
+#endif
+        for (; i < positions; ++i) {
+            if (text[i] == p[0] && text[i + m - 1] == p[m - 1] && memcmp(text + i + 1, p + 1, m - 2) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    string pattern;
+};
+
+/// \brief finds any of many patterns in one pass over the text (Aho-Corasick).
+/// the failure links are folded into a full transition table when it is built,
+/// so each byte of text costs one table lookup.
+class multi_substring_search
+{
+public:
+    explicit multi_substring_search(const vector<string>& patterns)
+        : empty_pattern(false) {
+        transitions.assign(256, 0);
+        accepting.push_back(0);
+        for (auto& pattern : patterns) {
+            if (pattern.empty()) {
+                empty_pattern = true;
+                continue;
+            }
+            int32_t state = 0;
+            for (auto c : pattern) {
+                auto at = state * 256 + static_cast<unsigned char>(c);
+                if (transitions[at] == 0) {
+                    transitions[at] = static_cast<int32_t>(accepting.size());
+                    accepting.push_back(0);
+                    transitions.resize(transitions.size() + 256, 0);
+                }
+                state = transitions[at];
+            }
+            accepting[state] = 1;
+        }
+        // breadth first, so the failure state of each state is complete before it is used
+        vector<int32_t> failure(accepting.size(), 0);
+        deque<int32_t> pending;
+        for (int c = 0; c < 256; ++c) {
+            if (transitions[c] != 0) {
+                pending.push_back(transitions[c]);
+            }
+        }
+        while (!pending.empty()) {
+            auto state = pending.front();
+            pending.pop_front();
+            accepting[state] = accepting[state] | accepting[failure[state]];
+            for (int c = 0; c < 256; ++c) {
+                auto& next = transitions[state * 256 + c];
+                if (next != 0) {
+                    failure[next] = transitions[failure[state] * 256 + c];
+                    pending.push_back(next);
+                } else {
+                    next = transitions[failure[state] * 256 + c];
+                }
+            }
+        }
+    }
+
+    bool in(const char* text, size_t size) const {
+        if (empty_pattern) {
+            return true;
+        }
+        auto table = transitions.data();
+        int32_t state = 0;
+        for (size_t i = 0; i < size; ++i) {
+            state = table[state * 256 + static_cast<unsigned char>(text[i])];
+            if (accepting[state]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    bool empty_pattern;
+    vector<int32_t> transitions;
+    vector<uint8_t> accepting;
+};
+
+inline text_view text_of(const string& s) {
+    return text_view(s);
+}
+inline text_view text_of(text_view t) {
+    return t;
+}
+inline text_view text_of(const char* s) {
+    return text_view(s, strlen(s));
+}
+
+template<class Search, class Observer, class T>
+void filter_text(const Search& search, Observer& r, T v) {
+    auto t = text_of(v);
+    if (search.in(t.data(), t.size())) {
+        r.next(move(v));
+    }
+}
+
+template<class Search, class Observer, class T>
+void filter_text(const Search& search, Observer& r, vector<T> batch) {
+    batch.erase(remove_if(batch.begin(), batch.end(), [&](const T& v){
+        auto t = text_of(v);
+        return !search.in(t.data(), t.size());
+    }), batch.end());
+    if (!batch.empty()) {
+        r.next(move(batch));
+    }
+}
+
+template<class Search>
+auto make_contains(shared_ptr<const Search> search){
+    return make_lifter([=](auto scbr){
+        info("contains bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("contains bound to context");
+            auto r = scbr.create(ctx);
+            return make_observer(r, r.lifetime, [=](auto& r, auto v){
+                filter_text(*search, r, move(v));
+            });
+        });
+    });
+}
+
+}
+
+/// \brief passes the string or text_view values that contain pattern.
+/// vector values are treated as batches, each is filtered and emitted when not empty.
+inline auto contains(string pattern){
+    info("new contains");
+    return detail::make_contains(make_shared<const detail::substring_search>(move(pattern)));
+}
+
+/// \brief passes the string or text_view values that contain any of the patterns.
+/// all the patterns are matched in a single pass over each value.
+/// vector values are treated as batches, each is filtered and emitted when not empty.
+inline auto contains_any(const vector<string>& patterns){
+    info("new contains_any");
+    return detail::make_contains(make_shared<const detail::multi_substring_search>(patterns));
+}
+
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+/// \brief a blocked bloom filter. each value sets one bit in each of the
+/// eight 64bit words of a single cache-line sized block, so a probe reads
+/// one cache line and all eight bits are tested at once.
+class bloom_blocks
+{
+public:
+    static const size_t words = 8;
+
+    explicit bloom_blocks(size_t count, double bits_per_value)
+        : blocks(max<size_t>(1, static_cast<size_t>(ceil(count * bits_per_value / (words * 64))))) {
+        // over-allocate so that the blocks can start on a cache line
+        storage.assign(blocks * words + words - 1, 0);
+        auto address = reinterpret_cast<uintptr_t>(storage.data());
+        offset = ((64 - address % 64) % 64) / sizeof(uint64_t);
+    }
+
+    bloom_blocks(const bloom_blocks&) = delete;
+    bloom_blocks& operator=(const bloom_blocks&) = delete;
+
+    /// \brief mixes a hash into 64 well distributed bits
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    size_t block(uint64_t h) const {
+        // maps the high bits onto [0, blocks) without a division
+        return static_cast<size_t>(((h >> 32) * blocks) >> 32);
+    }
+
+    const uint64_t* at(size_t b) const {
+        return storage.data() + offset + b * words;
+    }
+
+    void insert(uint64_t h) {
+        auto w = const_cast<uint64_t*>(at(block(h)));
+        auto low = static_cast<uint32_t>(h);
+        for (size_t i = 0; i < words; ++i) {
+            w[i] |= uint64_t(1) << ((low * salt(i)) >> 26);
+        }
+    }
+
+    void prefetch(uint64_t h) const {
+#if defined(__GNUC__)
+        __builtin_prefetch(at(block(h)));
+#else
+        (void)h;
+#endif
+    }
+
+    bool may_contain(uint64_t h) const {
+        auto w = at(block(h));
+        auto low = static_cast<uint32_t>(h);
+#if defined(__AVX2__)
+        const auto salts = _mm256_setr_epi32(salt(0), salt(1), salt(2), salt(3), salt(4), salt(5), salt(6), salt(7));
+        // eight 6bit positions, one for each word
+        auto positions = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(low)), salts), 26);
+        auto one = _mm256_set1_epi64x(1);
+        auto lowmask = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(positions)));
+        auto highmask = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(positions, 1)));
+        auto lowwords = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w));
+        auto highwords = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + 4));
+        // testc is 1 when every bit of the mask is set in the words
+        return _mm256_testc_si256(lowwords, lowmask) && _mm256_testc_si256(highwords, highmask);
+#else
+        uint64_t missing = 0;
+        for (size_t i = 0; i < words; ++i) {
+            missing |= ~w[i] & (uint64_t(1) << ((low * salt(i)) >> 26));
+        }
+        return missing == 0;
+#endif
+    }
+
+private:
+    static uint32_t salt(size_t i) {
+        static const uint32_t salts[words] = {
+            0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+        return salts[i];
+    }
+
+    size_t blocks;
+    size_t offset;
+    vector<uint64_t> storage;
+};
+
+}
+
+/// \brief an immutable set of values with a bloom filter in front of the exact set.
+/// most values that are not in the set are rejected by the filter with a single
+/// cache line read, the rest are checked against the exact set.
+template<class T, class Hash = hash<T>>
+class bloom_set
+{
+    struct shared_set
+    {
+        template<class Iterator>
+        shared_set(Iterator first, Iterator last, size_t count, double bits_per_value, Hash h)
+            : h(h)
+            , exact(first, last, count, h)
+            , filter(exact.size(), bits_per_value) {
+            for (auto& v : exact) {
+                filter.insert(hash_of(v));
+            }
+        }
+        uint64_t hash_of(const T& v) const {
+            return detail::bloom_blocks::mix(static_cast<uint64_t>(h(v)));
+        }
+        Hash h;
+        unordered_set<T, Hash> exact;
+        detail::bloom_blocks filter;
+    };
+
+public:
+    using value_type = T;
+
+    /// contains() is exact, bits_per_value sets how often the filter passes a
+    /// value that is not in the set on to the exact set. with eight bits set in
+    /// a 512 bit block, and the values spread over the blocks at random, the
+    /// filter passes about 2.9% at 8 bits per value, 1.0% at 10, 0.42% at 12
+    /// and 0.09% at 16.
+    template<class Range>
+    explicit bloom_set(const Range& values, double bits_per_value = 10, Hash h = Hash{})
+        : shared(make_shared<const shared_set>(begin(values), end(values), distance(begin(values), end(values)), bits_per_value, h)) {
+    }
+
+    bloom_set(initializer_list<T> values, double bits_per_value = 10, Hash h = Hash{})
+        : shared(make_shared<const shared_set>(values.begin(), values.end(), values.size(), bits_per_value, h)) {
+    }
+
+    bool contains(const T& v) const {
+        return shared->filter.may_contain(shared->hash_of(v)) && shared->exact.count(v) != 0;
+    }
+
+    /// \brief removes the values in batch where contains(v) != keep.
+    /// the filter blocks for the whole batch are prefetched before they are probed.
+    void select(vector<T>& batch, bool keep) const {
+        vector<uint64_t> hashes;
+        select(batch, keep, hashes);
+    }
+
+    /// \brief select() that keeps the hashes of the batch in hashes, which can be
+    /// reused for the next batch to avoid an allocation.
+    void select(vector<T>& batch, bool keep, vector<uint64_t>& hashes) const {
+        auto& s = *shared;
+        hashes.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            hashes[i] = s.hash_of(batch[i]);
+            s.filter.prefetch(hashes[i]);
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto found = s.filter.may_contain(hashes[i]) && s.exact.count(batch[i]) != 0;
+            if (found == keep) {
+                if (kept != i) {
+                    batch[kept] = move(batch[i]);
+                }
+                ++kept;
+            }
+        }
+        batch.resize(kept);
+    }
+
+    size_t size() const {
+        return shared->exact.size();
+    }
+
+private:
+    shared_ptr<const shared_set> shared;
+};
+
+namespace detail {
+
+/// the value is implicitly converted to T for the lookup and emitted unchanged
+template<class T, class Hash, class Observer, class V>
+void filter_member(const bloom_set<T, Hash>& set, bool keep, Observer& r, vector<uint64_t>& , V v) {
+    // a narrowing conversion, double to int for example, would find members
+    // that are not equal to the value
+    static_assert(!is_arithmetic<V>::value || !is_arithmetic<T>::value || is_same<common_type_t<V, T>, T>::value,
+        "filter_in values must convert to the set type without narrowing");
+    const T& key = v;
+    if (set.contains(key) == keep) {
+        r.next(move(v));
+    }
+}
+
+template<class T, class Hash, class Observer>
+void filter_member(const bloom_set<T, Hash>& set, bool keep, Observer& r, vector<uint64_t>& hashes, vector<T> batch) {
+    set.select(batch, keep, hashes);
+    if (!batch.empty()) {
+        r.next(move(batch));
+    }
+}
+
+template<class T, class Hash>
+auto make_filter_in(bloom_set<T, Hash> set, bool keep){
+    return make_lifter([=](auto scbr){
+        info("filter_in bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("filter_in bound to context");
+            auto r = scbr.create(ctx);
+            // the hashes of the last batch, reused by the next
+            auto hashes = make_state<vector<uint64_t>>(ctx.lifetime);
+            return make_observer(r, r.lifetime, [=](auto& r, auto v){
+                filter_member(set, keep, r, hashes.get(), move(v));
+            });
+        });
+    });
+}
+
+}
+
+/// \brief passes the values that are in set.
+/// other values are implicitly converted to T for the lookup, a narrowing conversion does not compile.
+/// vector<T> values are treated as batches, each is filtered and emitted when not empty.
+template<class T, class Hash>
+auto filter_in(bloom_set<T, Hash> set){
+    info("new filter_in");
+    return detail::make_filter_in(set, true);
+}
+
+/// \brief passes the values that are not in set.
+/// other values are implicitly converted to T for the lookup, a narrowing conversion does not compile.
+/// vector<T> values are treated as batches, each is filtered and emitted when not empty.
+template<class T, class Hash>
+auto filter_not_in(bloom_set<T, Hash> set){
+    info("new filter_not_in");
+    return detail::make_filter_in(set, false);
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+namespace rx {
+
+/// \brief splits chunks of bytes (buffer_chain, buffer_slice, string or vector<char> values)
+/// into the frames described by format and emits each frame as a buffer_chain.
+/// the chunks may split frames anywhere. a frame that lies within one chunk shares
+/// that chunk's block and is not copied. a source that completes inside a frame is an error.
+inline auto frame_decode(frame_format format = frame_format{}){
+    info("new frame_decode");
+    return make_lifter([=](auto scbr){
+        info("frame_decode bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("frame_decode bound to context");
+            auto r = scbr.create(ctx);
+            auto decoder = make_state<detail::frame_decoder>(ctx.lifetime, format);
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto chunk){
+                    auto& d = decoder.get();
+                    d.push(detail::to_buffer_chain(move(chunk)));
+                    for (;;) {
+                        buffer_chain frame;
+                        // framing errors are delivered to error, errors from the observer are not caught
+                        try {
+                            if (!d.next(frame)) {
+                                return;
+                            }
+                        } catch(...) {
+                            r.error(current_exception());
+                            return;
+                        }
+                        r.next(move(frame));
+                    }
+                },
+                detail::pass{},
+                [=](auto& r){
+                    if (decoder.get().partial()) {
+                        r.error(make_exception_ptr(frame_error("frame_decode source completed inside a frame")));
+                        return;
+                    }
+                    r.complete();
+                });
+        });
+    });
+}
+
+/// \brief prefixes each value (buffer_chain, buffer_slice, string or vector<char>) with
+/// its length and emits the frame as a buffer_chain. the payload slices are shared,
+/// not copied, so write_buffer_chain gathers the prefix and payload with one writev.
+inline auto frame_encode(frame_format format = frame_format{}){
+    info("new frame_encode");
+    return make_lifter([=](auto scbr){
+        info("frame_encode bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("frame_encode bound to context");
+            auto r = scbr.create(ctx);
+            return make_observer(r, r.lifetime, [=](auto& r, auto payload){
+                auto body = detail::to_buffer_chain(move(payload));
+                uint64_t length = body.size();
+                if (length > format.max_size || (format.prefix < 8 && (length >> (format.prefix * 8)) != 0)) {
+                    r.error(make_exception_ptr(frame_error("frame_encode payload of " + to_string(length) + " bytes does not fit the frame_format")));
+                    return;
+                }
+                string prefix(format.prefix, '\0');
+                for (size_t i = format.prefix; i > 0; --i, length >>= 8) {
+                    prefix[i - 1] = static_cast<char>(length & 0xff);
+                }
+                buffer_chain frame(move(prefix));
+                frame.append(move(body));
+                r.next(move(frame));
+            });
+        });
+    });
+}
+
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+namespace rx {
+
+/// \brief an immutable hash index with open addressing and linear probing.
+/// the slots hold only the mixed hash and the position of the entry, so a
+/// probe walks a dense array and compares keys only when the hashes match.
+/// when a key appears more than once the first entry is kept.
+template<class Key, class Value, class Hash = hash<Key>>
+class lookup_index
+{
+public:
+    using key_type = Key;
+    using value_type = Value;
+    using entry_type = pair<Key, Value>;
+
+    explicit lookup_index(vector<entry_type> entries, Hash h = Hash{})
+        : h(h)
+        , mask(0)
+        , shift(numeric_limits<size_t>::digits - 1) {
+        size_t capacity = 2;
+        while (capacity < entries.size() * 2) {
+            capacity *= 2;
+            --shift;
+        }
+        mask = capacity - 1;
+        slots.assign(capacity, slot{0, 0});
+        this->entries.reserve(entries.size());
+        for (auto& e : entries) {
+            auto tag = mix(e.first);
+            auto at = probe(e.first, tag);
+            if (slots[at].tag == 0) {
+                slots[at] = slot{tag, this->entries.size()};
+                this->entries.push_back(move(e));
+            }
+        }
+    }
+
+    /// \returns the value for k or nullptr when k is not in the index
+    const Value* find(const Key& k) const {
+        auto at = probe(k, mix(k));
+        return slots[at].tag == 0 ? nullptr : &entries[slots[at].position].second;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    /// fibonacci hashing spreads identity hashes (such as hash<int>) across the table.
+    /// the slot is chosen by the high bits. 0 marks an empty slot, so the low bit is always set.
+    size_t mix(const Key& k) const {
+        return (static_cast<size_t>(h(k)) * static_cast<size_t>(0x9E3779B97F4A7C15ull)) | 1;
+    }
+
+    /// \returns the slot that holds k or the empty slot where k would be inserted
+    size_t probe(const Key& k, size_t tag) const {
+        auto at = tag >> shift;
+        while (slots[at].tag != 0 && (slots[at].tag != tag || !(entries[slots[at].position].first == k))) {
+            at = (at + 1) & mask;
+        }
+        return at;
+    }
+
+    struct slot
+    {
+        size_t tag;
+        size_t position;
+    };
+
+    Hash h;
+    size_t mask;
+    int shift;
+    vector<slot> slots;
+    vector<entry_type> entries;
+};
+
+/// \brief a shared handle to the current lookup_index.
+/// publish() replaces the index without blocking readers. a reader holds the
+/// index only while it joins a value, the previous index is freed when the
+/// last value that was joined with it is done.
+template<class Key, class Value, class Hash = hash<Key>>
+class lookup_table
+{
+public:
+    using index_type = lookup_index<Key, Value, Hash>;
+    using entry_type = typename index_type::entry_type;
+
+    explicit lookup_table(vector<entry_type> entries, Hash h = Hash{})
+        : shared(make_shared<published>(make_shared<const index_type>(move(entries), h))) {
+    }
+
+    /// \brief builds a new index from entries and makes it current.
+    /// the index is built on the calling thread.
+    void publish(vector<entry_type> entries, Hash h = Hash{}) const {
+        publish(make_shared<const index_type>(move(entries), h));
+    }
+
+    void publish(shared_ptr<const index_type> index) const {
+        atomic_store(&shared->index, move(index));
+        // the index is stored before the version is changed so that a
+        // reader that sees the new version will load the new index.
+        shared->version.fetch_add(1, memory_order_release);
+    }
+
+    long version() const {
+        return shared->version.load(memory_order_acquire);
+    }
+
+    shared_ptr<const index_type> current() const {
+        return atomic_load(&shared->index);
+    }
+
+private:
+    struct published
+    {
+        explicit published(shared_ptr<const index_type> index) : version(0), index(move(index)) {}
+        atomic<long> version;
+        shared_ptr<const index_type> index;
+    };
+    shared_ptr<published> shared;
+};
+
+namespace detail {
+
+/// \brief the index used by one subscription.
+/// the shared index is only loaded again when the version changes, so the
+/// per value cost is one acquire load. a replaced index is released when
+/// the next value sees the new version or when the subscription ends.
+template<class Table>
+struct lookup_reader
+{
+    lookup_reader() : version(-1) {}
+    long version;
+    shared_ptr<const typename Table::index_type> index;
+
+    /// \returns the current index
+    const typename Table::index_type& acquire(const Table& table) {
+        auto current = table.version();
+        if (current != version) {
+            index = table.current();
+            version = current;
+        }
+        return *index;
+    }
+};
+
+}
+
+/// \brief emits pair(v, value) for each v where key(v) is found in the current index of table.
+/// values with keys that are not in the index are not emitted.
+template<class Key, class Value, class Hash, class KeyFn>
+auto lookup_join(lookup_table<Key, Value, Hash> table, KeyFn key){
+    info("new lookup_join");
+    using table_type = lookup_table<Key, Value, Hash>;
+    return make_lifter([=](auto scbr){
+        info("lookup_join bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("lookup_join bound to context");
+            auto r = scbr.create(ctx);
+            auto reader = make_state<detail::lookup_reader<table_type>>(ctx.lifetime);
+            ctx.lifetime.insert([reader](){
+                // do not keep the index until the state is destroyed
+                reader.get().index.reset();
+            });
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto v){
+                    auto& index = reader.get().acquire(table);
+                    auto found = index.find(key(v));
+                    if (found) {
+                        r.next(make_pair(move(v), *found));
+                    }
+                });
+        });
+    });
+}
+
+}
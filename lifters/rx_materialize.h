@@ -0,0 +1,330 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+/// \brief a linear probing table of fixed size entries, each guarded by a seqlock.
+/// one writer updates the entries while any number of readers copy them without
+/// a lock. a reader that sees the sequence change while it copies an entry copies
+/// it again. the entries are stored in atomic words so that the copies do not race.
+template<class Key, class Value>
+class seqlock_table
+{
+public:
+    static const size_t words = (sizeof(Key) + sizeof(Value) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    explicit seqlock_table(size_t capacity)
+        : count(0) {
+        size_t slots = 2;
+        int bits = 1;
+        while (slots < capacity) {
+            slots *= 2;
+            ++bits;
+        }
+        mask = slots - 1;
+        shift = numeric_limits<uint64_t>::digits - bits;
+        entries.reset(new slot[slots]);
+    }
+    seqlock_table(const seqlock_table&) = delete;
+    seqlock_table& operator=(const seqlock_table&) = delete;
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    /// \returns true when another entry would make the table more than 3/4 full
+    bool full() const {
+        return (count.load(memory_order_relaxed) + 1) * 4 > capacity() * 3;
+    }
+
+    size_t size() const {
+        return count.load(memory_order_acquire);
+    }
+
+    /// \brief inserts or replaces the entry for k, called by the writer only.
+    void update(uint64_t tag, const Key& k, const Value& v) {
+        uint64_t packed[words];
+        pack(packed, k, v);
+        auto at = static_cast<size_t>(tag >> shift);
+        for (;; at = (at + 1) & mask) {
+            auto& s = entries[at];
+            auto current = s.tag.load(memory_order_relaxed);
+            if (current == 0) {
+                store(s, packed);
+                // the entry is complete before a reader can find the tag
+                s.tag.store(tag, memory_order_release);
+                count.fetch_add(1, memory_order_release);
+                return;
+            }
+            if (current == tag && key_at(s) == k) {
+                auto sequence = s.sequence.load(memory_order_relaxed);
+                s.sequence.store(sequence + 1, memory_order_relaxed);
+                atomic_thread_fence(memory_order_release);
+                store(s, packed);
+                s.sequence.store(sequence + 2, memory_order_release);
+                return;
+            }
+        }
+    }
+
+    /// \brief copies the value of k to out, called by any thread.
+    bool find(uint64_t tag, const Key& k, Value& out) const {
+        auto at = static_cast<size_t>(tag >> shift);
+        for (;; at = (at + 1) & mask) {
+            auto& s = entries[at];
+            auto current = s.tag.load(memory_order_acquire);
+            if (current == 0) {
+                return false;
+            }
+            if (current != tag) {
+                continue;
+            }
+            uint64_t packed[words];
+            read(s, packed);
+            Key key;
+            memcpy(addressof(key), packed, sizeof(Key));
+            if (key == k) {
+                memcpy(addressof(out), reinterpret_cast<const char*>(packed) + sizeof(Key), sizeof(Value));
+                return true;
+            }
+        }
+    }
+
+    /// \brief calls f(const Key&, const Value&) with a copy of each entry, called by any thread.
+    template<class F>
+    void for_each(F&& f) const {
+        for (size_t at = 0; at <= mask; ++at) {
+            auto& s = entries[at];
+            if (s.tag.load(memory_order_acquire) == 0) {
+                continue;
+            }
+            uint64_t packed[words];
+            read(s, packed);
+            Key key;
+            Value value;
+            memcpy(addressof(key), packed, sizeof(Key));
+            memcpy(addressof(value), reinterpret_cast<const char*>(packed) + sizeof(Key), sizeof(Value));
+            f(static_cast<const Key&>(key), static_cast<const Value&>(value));
+        }
+    }
+
+    /// \brief inserts each entry into to, called by the writer only.
+    void copy_to(seqlock_table& to) const {
+        for (size_t at = 0; at <= mask; ++at) {
+            auto& s = entries[at];
+            auto tag = s.tag.load(memory_order_relaxed);
+            if (tag == 0) {
+                continue;
+            }
+            uint64_t packed[words];
+            for (size_t i = 0; i < words; ++i) {
+                packed[i] = s.packed[i].load(memory_order_relaxed);
+            }
+            Key key;
+            Value value;
+            memcpy(addressof(key), packed, sizeof(Key));
+            memcpy(addressof(value), reinterpret_cast<const char*>(packed) + sizeof(Key), sizeof(Value));
+            to.update(tag, key, value);
+        }
+    }
+
+private:
+    struct slot
+    {
+        slot() : sequence(0), tag(0) {
+            for (auto& w : packed) {
+                w.store(0, memory_order_relaxed);
+            }
+        }
+        atomic<uint64_t> sequence;
+        atomic<uint64_t> tag;
+        atomic<uint64_t> packed[words];
+    };
+
+    static void pack(uint64_t* packed, const Key& k, const Value& v) {
+        memset(packed, 0, words * sizeof(uint64_t));
+        memcpy(packed, addressof(k), sizeof(Key));
+        memcpy(reinterpret_cast<char*>(packed) + sizeof(Key), addressof(v), sizeof(Value));
+    }
+
+    static void store(slot& s, const uint64_t* packed) {
+        for (size_t i = 0; i < words; ++i) {
+            s.packed[i].store(packed[i], memory_order_relaxed);
+        }
+    }
+
+    static void read(const slot& s, uint64_t* packed) {
+        for (;;) {
+            auto before = s.sequence.load(memory_order_acquire);
+            if (before & 1) {
+                this_thread::yield();
+                continue;
+            }
+            for (size_t i = 0; i < words; ++i) {
+                packed[i] = s.packed[i].load(memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+            if (s.sequence.load(memory_order_relaxed) == before) {
+                return;
+            }
+        }
+    }
+
+    /// the writer reads its own writes without the seqlock
+    static Key key_at(const slot& s) {
+        uint64_t packed[words];
+        for (size_t i = 0; i < words; ++i) {
+            packed[i] = s.packed[i].load(memory_order_relaxed);
+        }
+        Key key;
+        memcpy(addressof(key), packed, sizeof(Key));
+        return key;
+    }
+
+    size_t mask;
+    int shift;
+    atomic<size_t> count;
+    unique_ptr<slot[]> entries;
+};
+
+}
+
+/// \brief the latest value for each key, updated by materialize on one strand and
+/// read from any thread without a lock. Key and Value must be trivially copyable.
+///
+/// each read copies one entry under its seqlock, so it never sees a partial update.
+/// reads of many entries (for_each) see each entry at some point during the read,
+/// not all of them at one instant.
+///
+/// when the table is 3/4 full it is copied to a table of twice the capacity, which
+/// is published. the old tables are kept until the last copy of the
+/// materialized_table is released, because a reader may still be in one, so a
+/// table that grew holds up to twice the memory of its current table. a capacity
+/// that fits the keys avoids the growth and the copies.
+///
+/// only the holder of the writer from claim() updates the table.
+template<class Key, class Value, class Hash = hash<Key>>
+class materialized_table
+{
+    static_assert(is_trivially_copyable<Key>::value && is_trivially_copyable<Value>::value, "materialized_table requires trivially copyable keys and values");
+    static_assert(is_default_constructible<Key>::value && is_default_constructible<Value>::value, "materialized_table requires default constructible keys and values");
+
+    using table_type = detail::seqlock_table<Key, Value>;
+
+    struct published
+    {
+        published(size_t capacity, Hash h) : h(h), claimed(false) {
+            tables.push_back(make_unique<table_type>(capacity));
+            current.store(tables.back().get(), memory_order_relaxed);
+        }
+        Hash h;
+        atomic<table_type*> current;
+        /// every table that was published, readers may still hold the older ones
+        vector<unique_ptr<table_type>> tables;
+        /// a writer is active
+        atomic<bool> claimed;
+    };
+
+public:
+    using key_type = Key;
+    using value_type = Value;
+
+    /// \brief the one thread at a time that updates the table
+    class writer
+    {
+    public:
+        explicit writer(shared_ptr<published> shared) : shared(move(shared)), held(true) {}
+        ~writer() {
+            release();
+        }
+        writer(const writer&) = delete;
+        writer& operator=(const writer&) = delete;
+
+        /// \brief sets the value of k
+        void update(const Key& k, const Value& v) {
+            auto& s = *shared;
+            auto current = s.current.load(memory_order_relaxed);
+            if (current->full()) {
+                s.tables.push_back(make_unique<table_type>(current->capacity() * 2));
+                current->copy_to(*s.tables.back());
+                current = s.tables.back().get();
+                s.current.store(current, memory_order_release);
+            }
+            current->update(detail::keyed_tag(s.h(k)), k, v);
+        }
+
+        /// \brief lets another writer claim the table, this writer must not update it again
+        void release() {
+            if (held.exchange(false)) {
+                shared->claimed.store(false, memory_order_release);
+            }
+        }
+
+    private:
+        shared_ptr<published> shared;
+        atomic<bool> held;
+    };
+
+    explicit materialized_table(size_t capacity = 1024, Hash h = Hash{})
+        : shared(make_shared<published>(capacity, h)) {
+    }
+
+    /// \brief copies the value of k to out. \returns false when k has no value.
+    bool find(const Key& k, Value& out) const {
+        return shared->current.load(memory_order_acquire)->find(detail::keyed_tag(shared->h(k)), k, out);
+    }
+
+    size_t size() const {
+        return shared->current.load(memory_order_acquire)->size();
+    }
+
+    /// \brief calls f(const Key&, const Value&) with a copy of each entry
+    template<class F>
+    void for_each(F&& f) const {
+        shared->current.load(memory_order_acquire)->for_each(forward<F>(f));
+    }
+
+    /// \brief claims the writer role. \returns nullptr while another writer holds it.
+    unique_ptr<writer> claim() const {
+        bool idle = false;
+        if (!shared->claimed.compare_exchange_strong(idle, true, memory_order_acquire)) {
+            return nullptr;
+        }
+        return make_unique<writer>(shared);
+    }
+
+private:
+    shared_ptr<published> shared;
+};
+
+/// \brief sets the value of key(v) in table to v and passes v on, so the output
+/// is the stream of changes to the table. the table is read from other threads.
+/// a table has one writer, a second subscription while one is active delivers
+/// a logic_error.
+template<class Key, class Value, class Hash, class KeyFn>
+auto materialize(materialized_table<Key, Value, Hash> table, KeyFn key){
+    info("new materialize");
+    return make_lifter([=](auto scbr){
+        info("materialize bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("materialize bound to context");
+            auto r = scbr.create(ctx);
+            shared_ptr<typename materialized_table<Key, Value, Hash>::writer> writer = table.claim();
+            if (!writer) {
+                r.error(make_exception_ptr(logic_error("materialize table is updated by another subscription")));
+            } else {
+                ctx.lifetime.insert([writer](){
+                    writer->release();
+                });
+            }
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto v){
+                    writer->update(key(v), v);
+                    r.next(move(v));
+                });
+        });
+    });
+}
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+/// \brief a bounded cache with open addressing and CLOCK eviction.
+/// the slots hold only the mixed hash and the position of the entry. a hit sets
+/// the referenced bit of the entry, a miss on a full cache moves the clock hand
+/// past the referenced entries, clearing their bits, and replaces the first
+/// entry that was not referenced since the hand last passed it.
+/// the slot index is taken from the high bits of the mixed hash below the
+/// top skip_bits, which memoize_cache uses to choose the shard.
+template<class Key, class Result, class Hash = hash<Key>>
+class clock_cache
+{
+public:
+    explicit clock_cache(size_t capacity, Hash h = Hash{}, int skip_bits = 0)
+        : h(h)
+        , limit(max<size_t>(capacity, 1))
+        , hand(0) {
+        size_t count = 2;
+        int bits = 1;
+        while (count < limit * 2) {
+            count *= 2;
+            ++bits;
+        }
+        mask = count - 1;
+        shift = numeric_limits<uint64_t>::digits - skip_bits - bits;
+        slots.assign(count, slot{0, 0});
+        entries.reserve(limit);
+    }
+
+    /// \returns the cached result for k or nullptr
+    const Result* find(const Key& k) {
+        auto at = probe(k, keyed_tag(h(k)));
+        if (slots[at].tag == 0) {
+            return nullptr;
+        }
+        auto& e = entries[slots[at].position];
+        e.referenced = true;
+        return &e.result;
+    }
+
+    const Result& insert(const Key& k, Result r) {
+        auto tag = keyed_tag(h(k));
+        auto at = probe(k, tag);
+        if (slots[at].tag != 0) {
+            auto& e = entries[slots[at].position];
+            e.result = move(r);
+            return e.result;
+        }
+        if (entries.size() < limit) {
+            slots[at] = slot{tag, entries.size()};
+            entries.push_back(entry{k, move(r), false});
+            return entries.back().result;
+        }
+        auto position = victim();
+        auto& e = entries[position];
+        remove(probe(e.key, keyed_tag(h(e.key))));
+        e.key = k;
+        e.result = move(r);
+        e.referenced = false;
+        // the removal may have moved the empty slot for k
+        slots[probe(k, tag)] = slot{tag, position};
+        return e.result;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    struct slot
+    {
+        uint64_t tag;
+        size_t position;
+    };
+
+    struct entry
+    {
+        Key key;
+        Result result;
+        bool referenced;
+    };
+
+    size_t victim() {
+        for (;;) {
+            auto& e = entries[hand];
+            auto position = hand;
+            hand = (hand + 1) % entries.size();
+            if (!e.referenced) {
+                return position;
+            }
+            e.referenced = false;
+        }
+    }
+
+    size_t probe(const Key& k, uint64_t tag) const {
+        auto at = static_cast<size_t>(tag >> shift) & mask;
+        while (slots[at].tag != 0 && (slots[at].tag != tag || !(entries[slots[at].position].key == k))) {
+            at = (at + 1) & mask;
+        }
+        return at;
+    }
+
+    void remove(size_t at) {
+        keyed_backward_shift(at, mask, shift, slots,
+            [](vector<slot>& s, size_t i){ return s[i].tag; },
+            [](vector<slot>& s, size_t to, size_t from){ s[to] = s[from]; },
+            [](vector<slot>& s, size_t i){ s[i] = slot{0, 0}; });
+    }
+
+    Hash h;
+    size_t limit;
+    size_t hand;
+    size_t mask;
+    int shift;
+    vector<slot> slots;
+    vector<entry> entries;
+};
+
+/// \brief calls f for the values that are not in the cache
+template<class F, class Cache, class V>
+auto memoized(const F& f, Cache& cache, const V& v) {
+    auto found = cache.find(v);
+    if (found) {
+        return *found;
+    }
+    return cache.insert(v, f(v));
+}
+
+}
+
+/// \brief a cache of results that is shared by many memoize_transform subscriptions,
+/// on any threads. the cache is split into shards by hash, each with its own lock
+/// and CLOCK eviction, so that concurrent lookups seldom wait for each other.
+/// the function is called outside the lock, two threads that miss the same key
+/// may both call it.
+template<class Key, class Result, class Hash = hash<Key>>
+class memoize_cache
+{
+    using shard_type = detail::clock_cache<Key, Result, Hash>;
+    struct shard
+    {
+        shard(size_t capacity, int skip_bits, Hash h) : cache(capacity, h, skip_bits) {}
+        mutex lock;
+        shard_type cache;
+    };
+    struct shared_cache
+    {
+        shared_cache(size_t capacity, size_t count, Hash h) : h(h), bits(0) {
+            size_t shards = 1;
+            while (shards < count) {
+                shards *= 2;
+                ++bits;
+            }
+            for (size_t i = 0; i < shards; ++i) {
+                parts.push_back(make_unique<shard>((capacity + shards - 1) / shards, bits, h));
+            }
+        }
+        Hash h;
+        /// log2 of the number of shards
+        int bits;
+        vector<unique_ptr<shard>> parts;
+    };
+
+public:
+    using key_type = Key;
+    using result_type = Result;
+
+    explicit memoize_cache(size_t capacity, size_t shards = 16, Hash h = Hash{})
+        : shared(make_shared<shared_cache>(capacity, shards, h)) {
+    }
+
+    /// \brief copies the cached result for k to out. \returns false on a miss.
+    bool find(const Key& k, Result& out) const {
+        auto& s = part(k);
+        unique_lock<mutex> guard(s.lock);
+        auto found = s.cache.find(k);
+        if (!found) {
+            return false;
+        }
+        out = *found;
+        return true;
+    }
+
+    void insert(const Key& k, const Result& r) const {
+        auto& s = part(k);
+        unique_lock<mutex> guard(s.lock);
+        s.cache.insert(k, r);
+    }
+
+private:
+    shard& part(const Key& k) const {
+        // the shard is chosen by the top bits of the tag and the table within a shard
+        // uses the bits below them. the low bits of the tag only depend on the low bits
+        // of the hash, which are the same for keys that are multiples of a power of two.
+        if (shared->bits == 0) {
+            return *shared->parts.front();
+        }
+        auto tag = detail::keyed_tag(shared->h(k));
+        return *shared->parts[static_cast<size_t>(tag >> (numeric_limits<uint64_t>::digits - shared->bits))];
+    }
+
+    shared_ptr<shared_cache> shared;
+};
+
+/// \brief emits f(v) for each v, where f is a pure function. the results for up to
+/// capacity recent values are cached by the subscription, a repeated value is
+/// looked up instead of calling f. values are compared with == and hashed with hash<V>.
+template<class F>
+auto memoize_transform(F f, size_t capacity){
+    info("new memoize_transform");
+    return make_lifter([=](auto scbr){
+        info("memoize_transform bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("memoize_transform bound to context");
+            auto r = scbr.create(ctx);
+            // clock_cache<V, decltype(f(v))>
+            auto cache = make_state<detail::late_bound>(ctx.lifetime);
+            return make_observer(r, r.lifetime, [=](auto& r, auto& v){
+                using key_type = decay_t<decltype(v)>;
+                using result_type = decay_t<decltype(f(v))>;
+                auto& c = cache.get().template get<detail::clock_cache<key_type, result_type>>(capacity);
+                r.next(detail::memoized(f, c, v));
+            });
+        });
+    });
+}
+
+/// \brief emits f(v) for each v, where f is a pure function, with the results cached
+/// in cache, which may be shared with other subscriptions on other threads.
+template<class F, class Key, class Result, class Hash>
+auto memoize_transform(F f, memoize_cache<Key, Result, Hash> cache){
+    info("new memoize_transform");
+    return make_lifter([=](auto scbr){
+        info("memoize_transform bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("memoize_transform bound to context");
+            auto r = scbr.create(ctx);
+            return make_observer(r, r.lifetime, [=](auto& r, auto& v){
+                Result result;
+                if (!cache.find(v, result)) {
+                    result = f(v);
+                    cache.insert(v, result);
+                }
+                r.next(move(result));
+            });
+        });
+    });
+}
+
+}
@@ -0,0 +1,415 @@
+#pragma once
+
+namespace rx {
+
+class csv_format_error : public runtime_error {
+public:
+  explicit csv_format_error (const string& what_arg) : runtime_error(what_arg) {}
+  explicit csv_format_error (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+/// \brief the dialect of the delimited text.
+/// when header is true the first row holds the column names.
+struct csv_format
+{
+    explicit csv_format(char delimiter = ',', bool header = false, char quote = '"')
+        : delimiter(delimiter)
+        , header(header)
+        , quote(quote) {
+    }
+    char delimiter;
+    bool header;
+    char quote;
+};
+
+/// \brief the complete rows parsed from one chunk of text.
+/// text is a copy of the chunk, after the partial row carried from the
+/// previous chunk. the fields are views into text, which the batch shares,
+/// so the fields are not copied one at a time.
+class csv_batch
+{
+public:
+    csv_batch() : rows(0), width(0), quote('"') {}
+
+    shared_ptr<const string> text;
+    /// the column names from the header row, empty without a header
+    shared_ptr<const vector<string>> names;
+    size_t rows;
+    size_t width;
+    /// rows * width fields in row order, without the enclosing quotes
+    vector<text_view> fields;
+    /// 1 for the fields that were quoted and may contain escaped quotes
+    vector<uint8_t> quoted;
+    char quote;
+
+    text_view view(size_t row, size_t col) const {
+        return fields[row * width + col];
+    }
+
+    /// \returns the field with escaped quotes replaced
+    string str(size_t row, size_t col) const {
+        auto field = view(row, col);
+        if (!quoted[row * width + col]) {
+            return field.str();
+        }
+        string result;
+        result.reserve(field.size());
+        for (size_t i = 0; i < field.size(); ++i) {
+            result.push_back(field[i]);
+            if (field[i] == quote && i + 1 < field.size() && field[i + 1] == quote) {
+                ++i;
+            }
+        }
+        return result;
+    }
+
+    /// \brief converts column col of every row to T.
+    /// fields that are empty or do not convert are null. T may be an integral or floating
+    /// point type, string, or text_view (a view into text that is valid while text is).
+    template<class T>
+    column<T> to_column(size_t col) const;
+
+    /// \returns a record_batch with the first sizeof...(Tn) columns converted to Tn
+    template<class... Tn>
+    record_batch<Tn...> to_record_batch() const {
+        if (sizeof...(Tn) > width) {
+            throw csv_format_error("parse_csv has " + to_string(width) + " columns, " + to_string(sizeof...(Tn)) + " were requested");
+        }
+        return to_record_batch<Tn...>(make_index_sequence<sizeof...(Tn)>{});
+    }
+
+private:
+    template<class... Tn, size_t... In>
+    record_batch<Tn...> to_record_batch(index_sequence<In...>) const {
+        record_batch<Tn...> result;
+        result.columns = typename record_batch<Tn...>::columns_type{to_column<Tn>(In)...};
+        result.rows = rows;
+        return result;
+    }
+};
+
+namespace detail {
+
+/// \brief appends the offset of every delimiter, newline and quote in text to out.
+/// the bytes are compared 32 (AVX2) or 16 (SSE2) at a time and the offsets are
+/// taken from the bits of the comparison mask.
+inline void csv_structurals(const char* text, size_t size, char delimiter, char quote, vector<uint32_t>& out) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const auto d = _mm256_set1_epi8(delimiter);
+    const auto n = _mm256_set1_epi8('\n');
+    const auto q = _mm256_set1_epi8(quote);
+    for (; i + 32 <= size; i += 32) {
+        auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        auto hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, d), _mm256_cmpeq_epi8(block, n)), _mm256_cmpeq_epi8(block, q));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+        for (; mask != 0; mask &= mask - 1) {
+            out.push_back(static_cast<uint32_t>(i + count_trailing_zeros(mask)));
+        }
+    }
+#elif defined(__SSE2__)
+    const auto d = _mm_set1_epi8(delimiter);
+    const auto n = _mm_set1_epi8('\n');
+    const auto q = _mm_set1_epi8(quote);
+    for (; i + 16 <= size; i += 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, d), _mm_cmpeq_epi8(block, n)), _mm_cmpeq_epi8(block, q));
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+        for (; mask != 0; mask &= mask - 1) {
+            out.push_back(static_cast<uint32_t>(i + count_trailing_zeros(mask)));
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        auto c = text[i];
+        if (c == delimiter || c == '\n' || c == quote) {
+            out.push_back(static_cast<uint32_t>(i));
+        }
+    }
+}
+
+inline bool csv_convert(text_view field, bool , bool& out) {
+    if (field == text_view("1", 1) || field == text_view("true", 4)) {
+        out = true;
+        return true;
+    }
+    if (field == text_view("0", 1) || field == text_view("false", 5)) {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+template<class T>
+enable_if_t<is_integral<T>::value, bool> csv_convert(text_view field, bool , T& out) {
+    using unsigned_type = make_unsigned_t<T>;
+    size_t i = 0;
+    auto negative = false;
+    if (!field.empty() && (field[0] == '-' || field[0] == '+')) {
+        negative = field[0] == '-';
+        ++i;
+    }
+    if (i == field.size() || (negative && !is_signed<T>::value)) {
+        return false;
+    }
+    auto limit = static_cast<unsigned_type>(numeric_limits<T>::max()) + (negative ? 1 : 0);
+    unsigned_type value = 0;
+    for (; i < field.size(); ++i) {
+        auto digit = static_cast<unsigned_type>(field[i] - '0');
+        if (field[i] < '0' || field[i] > '9' || value > (limit - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+    out = static_cast<T>(negative ? unsigned_type(0) - value : value);
+    return true;
+}
+
+template<class T>
+enable_if_t<is_floating_point<T>::value, bool> csv_convert(text_view field, bool , T& out) {
+    // the text is always followed by a delimiter, a newline or the terminating 0,
+    // none of which strtod accepts, so it stops inside the text.
+    if (field.empty() || isspace(static_cast<unsigned char>(field[0]))) {
+        return false;
+    }
+    char* end = nullptr;
+    auto value = strtod(field.data(), &end);
+    if (end != field.end()) {
+        return false;
+    }
+    out = static_cast<T>(value);
+    return true;
+}
+
+inline bool csv_convert(text_view field, bool , text_view& out) {
+    out = field;
+    return true;
+}
+
+/// \brief the rows of a stream of text chunks.
+/// a row that is not complete at the end of a chunk is carried into the next chunk.
+class csv_parser
+{
+public:
+    explicit csv_parser(csv_format format)
+        : format(format)
+        , width(0)
+        , line(0)
+        , header(format.header) {
+    }
+
+    csv_batch parse(text_view chunk, bool last) {
+        auto text = make_shared<string>();
+        text->reserve(carry.size() + chunk.size());
+        text->append(carry);
+        text->append(chunk.data(), chunk.size());
+        carry.clear();
+        if (text->size() > numeric_limits<uint32_t>::max()) {
+            throw csv_format_error("parse_csv chunks must be smaller than 4GiB");
+        }
+
+        csv_batch batch;
+        batch.text = text;
+        batch.quote = format.quote;
+        auto base = text->data();
+        auto size = text->size();
+
+        structurals.clear();
+        csv_structurals(base, size, format.delimiter, format.quote, structurals);
+
+        size_t line_start = 0;
+        size_t field_start = 0;
+        auto quoted = false;
+        auto add_field = [&](size_t end){
+            auto first = field_start;
+            auto is_quoted = false;
+            if (end - first >= 2 && base[first] == format.quote && base[end - 1] == format.quote) {
+                ++first;
+                --end;
+                is_quoted = true;
+            }
+            batch.fields.push_back(text_view(base + first, end - first));
+            batch.quoted.push_back(is_quoted ? 1 : 0);
+        };
+        auto end_row = [&](size_t end){
+            // a blank line is not a row
+            if (end == line_start) {
+                return;
+            }
+            add_field(end);
+            ++line;
+            auto count = batch.fields.size() - batch.rows * width;
+            if (width == 0) {
+                width = count;
+                batch.width = width;
+            }
+            if (count != width) {
+                throw csv_format_error("parse_csv line " + to_string(line) + " has " + to_string(count) + " fields, expected " + to_string(width));
+            }
+            if (header) {
+                header = false;
+                auto header_names = make_shared<vector<string>>();
+                for (size_t col = 0; col < width; ++col) {
+                    header_names->push_back(batch.str(0, col));
+                }
+                names = header_names;
+                batch.fields.clear();
+                batch.quoted.clear();
+                return;
+            }
+            ++batch.rows;
+        };
+        batch.width = width;
+
+        // the position of the second quote of an escaped pair
+        size_t escaped = size;
+        for (auto at : structurals) {
+            auto c = base[at];
+            if (c == format.quote) {
+                if (at == escaped) {
+                    continue;
+                }
+                if (!quoted) {
+                    // only a quote at the start of a field opens a quoted field (RFC 4180),
+                    // elsewhere in an unquoted field it is part of the text
+                    quoted = at == field_start;
+                } else if (at + 1 < size && base[at + 1] == format.quote) {
+                    escaped = at + 1;
+                } else {
+                    quoted = false;
+                }
+                continue;
+            }
+            if (quoted) {
+                continue;
+            }
+            if (c == format.delimiter) {
+                add_field(at);
+                field_start = at + 1;
+                continue;
+            }
+            // newline
+            auto end = at > line_start && base[at - 1] == '\r' ? at - 1 : at;
+            end_row(end);
+            line_start = field_start = at + 1;
+        }
+        if (last && line_start < size) {
+            auto end = base[size - 1] == '\r' ? size - 1 : size;
+            end_row(end);
+            line_start = size;
+        }
+        if (line_start < size) {
+            // the partial row is parsed again with the next chunk
+            carry.assign(base + line_start, size - line_start);
+            batch.fields.resize(batch.rows * width);
+            batch.quoted.resize(batch.rows * width);
+        }
+        batch.width = width;
+        batch.names = names;
+        return batch;
+    }
+
+private:
+    csv_format format;
+    size_t width;
+    size_t line;
+    bool header;
+    string carry;
+    vector<uint32_t> structurals;
+    shared_ptr<const vector<string>> names;
+};
+
+template<class... Tn>
+struct csv_output
+{
+    static_assert(all_true<!is_same<Tn, text_view>::value...>::value, "parse_csv cannot emit text_view columns, they would outlive the text. use string, or the views of a csv_batch");
+    static auto convert(csv_batch&& batch) {
+        return batch.to_record_batch<Tn...>();
+    }
+};
+template<>
+struct csv_output<>
+{
+    static csv_batch convert(csv_batch&& batch) {
+        return move(batch);
+    }
+};
+
+}
+
+template<class T>
+column<T> csv_batch::to_column(size_t col) const {
+    column<T> result;
+    result.reserve(rows);
+    for (size_t row = 0; row < rows; ++row) {
+        T value{};
+        if (detail::csv_convert(view(row, col), quoted[row * width + col] != 0, value)) {
+            result.push_back(move(value));
+        } else {
+            result.push_null();
+        }
+    }
+    return result;
+}
+
+template<>
+inline column<string> csv_batch::to_column<string>(size_t col) const {
+    column<string> result;
+    result.reserve(rows);
+    for (size_t row = 0; row < rows; ++row) {
+        result.push_back(str(row, col));
+    }
+    return result;
+}
+
+/// \brief parses chunks of delimited text (string, vector<char> or text_view values) into rows.
+/// the chunks may split rows anywhere, a partial row is completed by the next chunk.
+/// each chunk is copied once into the text of its batch.
+/// the delimiters, newlines and quotes of each chunk are found with SIMD comparisons.
+/// emits a csv_batch of field views for each chunk that completes rows, or when types
+/// Tn are given, a record_batch<Tn...> with the columns converted a column at a time.
+/// a row with a different number of fields than the first row is an error.
+template<class... Tn>
+auto parse_csv(csv_format format = csv_format{}){
+    info("new parse_csv");
+    return make_lifter([=](auto scbr){
+        info("parse_csv bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("parse_csv bound to context");
+            auto r = scbr.create(ctx);
+            auto parser = make_state<detail::csv_parser>(ctx.lifetime, format);
+            using output_type = decltype(detail::csv_output<Tn...>::convert(csv_batch{}));
+            // parse errors are delivered to error, errors from the observer are not caught
+            auto parse = [=](auto& r, text_view chunk, bool last, output_type& out){
+                try {
+                    auto batch = parser.get().parse(chunk, last);
+                    if (batch.rows == 0) {
+                        return false;
+                    }
+                    out = detail::csv_output<Tn...>::convert(move(batch));
+                    return true;
+                } catch(...) {
+                    r.error(current_exception());
+                    return false;
+                }
+            };
+            return make_observer(r, r.lifetime,
+                [=](auto& r, const auto& chunk){
+                    output_type out;
+                    if (parse(r, text_view(chunk.data(), chunk.size()), false, out)) {
+                        r.next(move(out));
+                    }
+                },
+                detail::pass{},
+                [=](auto& r){
+                    output_type out;
+                    if (parse(r, text_view(), true, out)) {
+                        r.next(move(out));
+                    }
+                    r.complete();
+                });
+        });
+    });
+}
+
+}
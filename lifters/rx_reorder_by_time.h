@@ -0,0 +1,252 @@
+#pragma once
+
+namespace rx {
+
+/// \brief what to do with a value whose timestamp is behind the watermark
+enum class reorder_late {
+    /// the value is not delivered
+    drop,
+    /// the value is delivered immediately, out of order
+    emit
+};
+
+namespace detail {
+
+/// \brief a min-heap of values keyed on timestamp.
+/// values with equal timestamps are released in arrival order.
+template<class Time, class Value>
+struct reorder_buffer
+{
+    struct item
+    {
+        Time at;
+        int64_t ordinal;
+        Value value;
+    };
+    struct later
+    {
+        bool operator()(const item& lhs, const item& rhs) const {
+            if (lhs.at == rhs.at) {
+                return lhs.ordinal > rhs.ordinal;
+            }
+            return rhs.at < lhs.at;
+        }
+    };
+
+    reorder_buffer() : ordinal(0), seen(false), released(false) {}
+
+    vector<item> heap;
+    int64_t ordinal;
+    bool seen;
+    Time max_seen;
+    bool released;
+    Time watermark;
+
+    bool empty() const {
+        return heap.empty();
+    }
+    const Time& top() const {
+        return heap.front().at;
+    }
+
+    /// \returns true if at is behind the watermark
+    bool is_late(const Time& at) const {
+        return released && at < watermark;
+    }
+
+    void push(Time at, Value&& v) {
+        if (!seen || max_seen < at) {
+            max_seen = at;
+            seen = true;
+        }
+        heap.push_back(item{move(at), ordinal++, move(v)});
+        push_heap(heap.begin(), heap.end(), later{});
+    }
+
+    /// \brief delivers all values with a timestamp at or before to in timestamp order
+    template<class Deliver>
+    void release(const Time& to, Deliver&& deliver) {
+        if (!released || watermark < to) {
+            watermark = to;
+            released = true;
+        }
+        while (!heap.empty() && !(watermark < heap.front().at)) {
+            pop_heap(heap.begin(), heap.end(), later{});
+            auto v = move(heap.back().value);
+            heap.pop_back();
+            deliver(move(v));
+        }
+    }
+
+    /// \brief delivers all values in timestamp order
+    template<class Deliver>
+    void flush(Deliver&& deliver) {
+        while (!heap.empty()) {
+            pop_heap(heap.begin(), heap.end(), later{});
+            auto v = move(heap.back().value);
+            heap.pop_back();
+            deliver(move(v));
+        }
+    }
+};
+
+template<class Time, class Value, class Clock>
+struct reorder_timed_buffer : public reorder_buffer<Time, Value>
+{
+    reorder_timed_buffer() : timer(false) {}
+    /// a timer is pending for due
+    bool timer;
+    time_point_t<Clock> due;
+};
+
+}
+
+/// \brief buffers values and delivers them in the order of ts(v).
+/// the watermark is the largest timestamp seen minus max_lateness, values are
+/// held until the watermark passes their timestamp. values that arrive
+/// behind the watermark are handled by the late policy.
+/// complete delivers the remaining values in order. values of a second type
+/// cannot be ordered with the first and are delivered as an error.
+template<class TimeStamp, class Lateness>
+auto reorder_by_time(TimeStamp ts, Lateness max_lateness, reorder_late late = reorder_late::drop){
+    info("new reorder_by_time");
+    return make_lifter([=](auto scbr){
+        info("reorder_by_time bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("reorder_by_time bound to context lifetime - " + to_string(reinterpret_cast<ptrdiff_t>(ctx.lifetime.store.get())));
+            auto r = scbr.create(ctx);
+            auto buffer = make_state<detail::late_bound>(ctx.lifetime);
+            auto flush = make_state<function<void()>>(ctx.lifetime);
+            ctx.lifetime.insert([flush](){
+                // flush holds the observer
+                flush.get() = nullptr;
+            });
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto v){
+                    using time_type = decay_t<decltype(ts(v))>;
+                    using value_type = decay_t<decltype(v)>;
+                    using buffer_type = detail::reorder_buffer<time_type, value_type>;
+                    if (buffer.get().template holds_other<buffer_type>()) {
+                        r.error(make_exception_ptr(logic_error("reorder_by_time values and timestamps must each have one type")));
+                        return;
+                    }
+                    auto& b = buffer.get().template get<buffer_type>();
+                    if (!flush.get()) {
+                        flush.get() = [&b, r](){
+                            b.flush([&](value_type&& v){r.next(move(v));});
+                        };
+                    }
+                    auto at = ts(v);
+                    if (b.is_late(at)) {
+                        if (late == reorder_late::emit) {
+                            r.next(move(v));
+                        }
+                        return;
+                    }
+                    b.push(at, move(v));
+                    b.release(b.max_seen - max_lateness, [&](value_type&& v){
+                        r.next(move(v));
+                    });
+                },
+                detail::pass{},
+                [=](auto& r){
+                    if (flush.get()) {
+                        flush.get()();
+                    }
+                    r.complete();
+                });
+        });
+    });
+}
+
+/// \brief buffers values and delivers them on the strand from makeStrand in the order of ts(v).
+/// ts(v) must return a time_point of the strand clock. the watermark is the larger of
+/// the largest timestamp seen and the strand's now(), minus max_lateness.
+/// a timer on the strand releases held values when no new values arrive.
+template<class MakeStrand, class TimeStamp, class Lateness>
+auto reorder_by_time(MakeStrand makeStrand, TimeStamp ts, Lateness max_lateness, reorder_late late = reorder_late::drop){
+    info("new reorder_by_time");
+    return make_lifter([=](auto scbr){
+        info("reorder_by_time bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("reorder_by_time bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto outcontext = copy_context(ctx.lifetime, makeStrand, ctx);
+            auto r = scbr.create(outcontext);
+            using clock_type = clock_t<decltype(outcontext)>;
+            auto buffer = make_state<detail::late_bound>(ctx.lifetime);
+            auto flush = make_state<function<void()>>(ctx.lifetime);
+            ctx.lifetime.insert([flush](){
+                // flush holds the observer
+                flush.get() = nullptr;
+            });
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    using time_type = decay_t<decltype(ts(v))>;
+                    using value_type = decay_t<decltype(v)>;
+                    using buffer_type = detail::reorder_timed_buffer<time_type, value_type, clock_type>;
+                    static_assert(is_same<time_type, time_point_t<clock_type>>::value, "reorder_by_time timestamps must be time_points of the strand clock");
+                    // runs on the strand
+                    auto release = [=](auto& r, auto& self){
+                        auto& b = buffer.get().template get<buffer_type>();
+                        auto now = outcontext.now();
+                        auto to = b.seen && now < b.max_seen ? b.max_seen : now;
+                        b.release(to - max_lateness, [&](value_type&& v){
+                            r.next(move(v));
+                        });
+                        if (b.empty() || (b.timer && !(b.top() + max_lateness < b.due))) {
+                            return;
+                        }
+                        b.timer = true;
+                        b.due = b.top() + max_lateness;
+                        auto expired = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                            auto& b = buffer.get().template get<buffer_type>();
+                            b.timer = false;
+                            self(r, self);
+                        }, detail::pass{}, detail::skip{});
+                        defer_at(outcontext, b.due, expired);
+                    };
+                    auto arrive = make_observer(r, subscription{}, [=](auto& r, auto& ) mutable {
+                        if (buffer.get().template holds_other<buffer_type>()) {
+                            r.error(make_exception_ptr(logic_error("reorder_by_time values and timestamps must each have one type")));
+                            return;
+                        }
+                        auto& b = buffer.get().template get<buffer_type>();
+                        if (!flush.get()) {
+                            flush.get() = [&b, r](){
+                                b.flush([&](value_type&& v){r.next(move(v));});
+                            };
+                        }
+                        auto at = ts(v);
+                        if (b.is_late(at)) {
+                            if (late == reorder_late::emit) {
+                                r.next(move(v));
+                            }
+                            return;
+                        }
+                        b.push(at, move(v));
+                        release(r, release);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, arrive);
+                },
+                [=](auto& r, auto e){
+                    auto error = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        r.error(e);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, error);
+                },
+                [=](auto& r){
+                    auto complete = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        if (flush.get()) {
+                            flush.get()();
+                        }
+                        r.complete();
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, complete);
+                });
+        });
+    });
+}
+
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+namespace rx {
+
+/// \brief the aggregate of the values with the same key that arrived
+/// without a gap in activity. first and last are the arrival times of
+/// the first and last values in the session.
+template<class Key, class Value, class TimePoint>
+struct session
+{
+    Key key;
+    TimePoint first;
+    TimePoint last;
+    Value value;
+};
+
+namespace detail {
+
+/// collects the values of a session into a vector
+struct session_collect
+{
+    template<class V>
+    vector<V> seed() const {
+        return {};
+    }
+    template<class V>
+    void operator()(vector<V>& acc, V&& v) const {
+        acc.push_back(move(v));
+    }
+};
+
+template<class Seed, class Accumulate>
+struct session_fold
+{
+    Seed s;
+    Accumulate a;
+    template<class V>
+    Seed seed() const {
+        return s;
+    }
+    template<class V>
+    void operator()(Seed& acc, V&& v) const {
+        acc = a(move(acc), move(v));
+    }
+};
+
+/// \brief the open sessions in the order of their last activity.
+/// since every session has the same gap, the session at the front
+/// is always the next to close, so one timer covers every key.
+template<class Key, class Acc, class Clock>
+struct session_table
+{
+    using time_point_type = time_point_t<Clock>;
+    using session_type = session<Key, Acc, time_point_type>;
+    using list_type = list<session_type>;
+
+    session_table() : timer(false), bound(false) {}
+
+    list_type active;
+    unordered_map<Key, typename list_type::iterator> index;
+    /// a timer is pending
+    bool timer;
+    /// the flush for this table is bound
+    bool bound;
+
+    session_type& touch(Key&& k, time_point_type now, Acc&& seed) {
+        auto found = index.find(k);
+        if (found == index.end()) {
+            active.push_back(session_type{k, now, now, move(seed)});
+            auto last = prev(active.end());
+            index.emplace(move(k), last);
+            return *last;
+        }
+        auto it = found->second;
+        it->last = now;
+        active.splice(active.end(), active, it);
+        return *it;
+    }
+
+    template<class Deliver>
+    void expire(time_point_type to, Deliver&& deliver) {
+        while (!active.empty() && !(to < active.front().last)) {
+            index.erase(active.front().key);
+            auto s = move(active.front());
+            active.pop_front();
+            deliver(move(s));
+        }
+    }
+};
+
+template<class MakeStrand, class KeyFn, class Duration, class Fold>
+auto make_session_window(MakeStrand makeStrand, KeyFn key, Duration gap, Fold fold){
+    return make_lifter([=](auto scbr){
+        info("session_window bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("session_window bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto outcontext = copy_context(ctx.lifetime, makeStrand, ctx);
+            auto r = scbr.create(outcontext);
+            using clock_type = clock_t<decltype(outcontext)>;
+            auto sessions = make_state<late_bound>(ctx.lifetime);
+            // one for each table type
+            auto flush = make_state<vector<function<void()>>>(ctx.lifetime);
+            ctx.lifetime.insert([flush](){
+                // flush holds the observer
+                flush.get().clear();
+            });
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    using key_type = decay_t<decltype(key(v))>;
+                    using value_type = decay_t<decltype(v)>;
+                    using acc_type = decay_t<decltype(fold.template seed<value_type>())>;
+                    using table_type = session_table<key_type, acc_type, clock_type>;
+                    // runs on the strand
+                    auto expire = [=](auto& r, auto& self){
+                        auto& t = sessions.get().template get<table_type>();
+                        t.expire(outcontext.now() - gap, [&](typename table_type::session_type&& s){
+                            r.next(move(s));
+                        });
+                        if (t.active.empty() || t.timer) {
+                            return;
+                        }
+                        t.timer = true;
+                        auto expired = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                            auto& t = sessions.get().template get<table_type>();
+                            t.timer = false;
+                            self(r, self);
+                        }, detail::pass{}, detail::skip{});
+                        defer_at(outcontext, t.active.front().last + gap, expired);
+                    };
+                    auto arrive = make_observer(r, subscription{}, [=](auto& r, auto& ) mutable {
+                        auto& t = sessions.get().template get<table_type>();
+                        if (!t.bound) {
+                            t.bound = true;
+                            flush.get().push_back([&t, r](){
+                                t.expire(time_point_t<clock_type>::max(), [&](typename table_type::session_type&& s){
+                                    r.next(move(s));
+                                });
+                            });
+                        }
+                        auto& s = t.touch(key_type(key(v)), outcontext.now(), fold.template seed<value_type>());
+                        fold(s.value, move(v));
+                        expire(r, expire);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, arrive);
+                },
+                [=](auto& r, auto e){
+                    auto error = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        r.error(e);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, error);
+                },
+                [=](auto& r){
+                    auto complete = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        for (auto& f : flush.get()) {
+                            f();
+                        }
+                        r.complete();
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, complete);
+                });
+        });
+    });
+}
+
+}
+
+/// \brief groups values by key(v) into sessions that close after gap without a value for the key.
+/// runs on the strand from makeStrand and emits a session with a vector of the values when it closes.
+/// the open sessions are kept in order of activity so that each value costs O(1) and
+/// a single pending timer closes sessions for all keys. complete closes all sessions.
+/// values of different types are kept in separate sessions.
+template<class MakeStrand, class KeyFn, class Duration>
+auto session_window(MakeStrand makeStrand, KeyFn key, Duration gap){
+    info("new session_window");
+    return detail::make_session_window(makeStrand, key, gap, detail::session_collect{});
+}
+
+/// \brief groups values by key(v) into sessions that close after gap without a value for the key.
+/// each session emits the fold of its values, acc = accumulate(acc, v), starting from seed.
+template<class MakeStrand, class KeyFn, class Duration, class Seed, class Accumulate>
+auto session_window(MakeStrand makeStrand, KeyFn key, Duration gap, Seed seed, Accumulate accumulate){
+    info("new session_window");
+    return detail::make_session_window(makeStrand, key, gap, detail::session_fold<Seed, Accumulate>{seed, accumulate});
+}
+
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+namespace rx {
+
+struct shed_load_counters
+{
+    shed_load_counters() : delivered(0), dropped(0), degraded(0) {}
+    atomic<long> delivered;
+    atomic<long> dropped;
+    atomic<long> degraded;
+};
+
+/// \brief target is the acceptable delay between the arrival of a value
+/// and its delivery on the strand. values are shed once the delay has
+/// stayed above target for a whole interval.
+struct shed_load_policy
+{
+    explicit shed_load_policy(steady_clock::duration target = 5ms, steady_clock::duration interval = 100ms)
+        : target(target)
+        , interval(interval)
+        , counters(make_shared<shed_load_counters>()) {
+    }
+    steady_clock::duration target;
+    steady_clock::duration interval;
+    shared_ptr<shed_load_counters> counters;
+};
+
+namespace detail {
+
+/// \brief the CoDel control loop. called on the strand for each value
+/// with the time that the value waited in the strand queue.
+template<class Clock>
+struct codel
+{
+    using clock_type = decay_t<Clock>;
+    using time_point_type = time_point_t<clock_type>;
+    using duration_type = duration_t<clock_type>;
+
+    explicit codel(const shed_load_policy& p)
+        : target(duration_cast<duration_type>(p.target))
+        , interval(duration_cast<duration_type>(p.interval))
+        , first_above()
+        , drop_next()
+        , count(0)
+        , lastcount(0)
+        , dropping(false) {
+    }
+
+    duration_type target;
+    duration_type interval;
+    time_point_type first_above;
+    time_point_type drop_next;
+    long count;
+    long lastcount;
+    bool dropping;
+
+    time_point_type control_law(time_point_type t) const {
+        return t + duration_cast<duration_type>(interval / sqrt(static_cast<double>(count)));
+    }
+
+    bool above_target(duration_type sojourn, time_point_type now) {
+        if (sojourn < target) {
+            first_above = time_point_type{};
+            return false;
+        }
+        if (first_above == time_point_type{}) {
+            first_above = now + interval;
+            return false;
+        }
+        return now >= first_above;
+    }
+
+    /// \returns true if the value should be shed
+    bool shed(duration_type sojourn, time_point_type now) {
+        auto ok_to_drop = above_target(sojourn, now);
+        if (dropping) {
+            if (!ok_to_drop) {
+                dropping = false;
+                return false;
+            }
+            if (now >= drop_next) {
+                ++count;
+                drop_next = control_law(drop_next);
+                return true;
+            }
+            return false;
+        }
+        if (ok_to_drop) {
+            dropping = true;
+            auto delta = count - lastcount;
+            count = (delta > 1 && now - drop_next < 16 * interval) ? delta : 1;
+            drop_next = control_law(now);
+            lastcount = count;
+            return true;
+        }
+        return false;
+    }
+};
+
+struct shed_drop
+{
+    template<class Observer, class V>
+    void operator()(const Observer&, V&&, shed_load_counters& counters) const {
+        ++counters.dropped;
+    }
+};
+
+template<class Degrade>
+struct shed_degrade
+{
+    Degrade d;
+    template<class Observer, class V>
+    void operator()(const Observer& r, V&& v, shed_load_counters& counters) const {
+        ++counters.degraded;
+        r.next(d(forward<V>(v)));
+    }
+};
+
+template<class MakeStrand, class Shed>
+auto make_shed_load(MakeStrand makeStrand, shed_load_policy policy, Shed shed){
+    return make_lifter([=](auto scbr){
+        info("shed_load bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("shed_load bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto outcontext = copy_context(ctx.lifetime, makeStrand, ctx);
+            auto r = scbr.create(outcontext);
+            using clock_type = clock_t<decltype(outcontext)>;
+            auto control = make_state<codel<clock_type>>(ctx.lifetime, policy);
+            auto counters = policy.counters;
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    auto arrival = outcontext.now();
+                    auto next = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        auto now = outcontext.now();
+                        if (control.get().shed(now - arrival, now)) {
+                            shed(r, v, *counters);
+                            return;
+                        }
+                        ++counters->delivered;
+                        r.next(v);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, next);
+                },
+                [=](auto& r, auto e){
+                    auto error = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        r.error(e);
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, error);
+                },
+                [=](auto& r){
+                    auto complete = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        r.complete();
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, complete);
+                });
+        });
+    });
+}
+
+}
+
+/// \brief delivers values on the strand from makeStrand and drops
+/// values when the time they spent waiting for the strand stays
+/// above the policy target (CoDel).
+/// policy.counters reports delivered and dropped values.
+template<class MakeStrand>
+auto shed_load(MakeStrand makeStrand, shed_load_policy policy = shed_load_policy{}){
+    info("new shed_load");
+    return detail::make_shed_load(makeStrand, policy, detail::shed_drop{});
+}
+
+/// \brief delivers values on the strand from makeStrand and delivers
+/// degrade(v) instead of v when the time that values spent waiting
+/// for the strand stays above the policy target (CoDel).
+/// policy.counters reports delivered and degraded values.
+template<class MakeStrand, class Degrade>
+auto shed_load(MakeStrand makeStrand, shed_load_policy policy, Degrade degrade){
+    info("new shed_load");
+    return detail::make_shed_load(makeStrand, policy, detail::shed_degrade<Degrade>{degrade});
+}
+
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief opens the ring of a shm_ring_source and writes records to it.
+class shm_ring_writer
+{
+public:
+    shm_ring_writer(string name, shm_ring_options options)
+        : name(move(name))
+        , options(options)
+        , stopped(false) {
+    }
+
+    /// \returns false when the writer was stopped.
+    bool send(const vector<buffer_chain>& records) {
+        if (!open()) {
+            return false;
+        }
+        for (auto& record : records) {
+            if (!ring->write(record, [this](){return stopped.load();})) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void finish() {
+        if (open()) {
+            ring->complete();
+        }
+    }
+
+    void fail(const string& what) {
+        if (open()) {
+            ring->fail(what);
+        }
+    }
+
+    /// a writer waiting for space notices within one wait timeout
+    void stop() {
+        stopped = true;
+    }
+
+private:
+    bool open() {
+        if (!ring) {
+            ring = shm_ring::open(name, options.connect_timeout, [this](){return stopped.load();});
+        }
+        return !!ring;
+    }
+
+    string name;
+    shm_ring_options options;
+    atomic<bool> stopped;
+    unique_ptr<shm_ring> ring;
+};
+
+}
+
+/// \brief writes each value (buffer_chain, buffer_slice, string or vector<char>) as
+/// a record to the ring buffer in shared memory named name that a shm_ring_source,
+/// which may be in another process, created. vector values are written as a batch.
+/// records of any length up to half the ring are copied once into the ring, no
+/// system call is made unless the source or the sink is waiting.
+///
+/// the sink blocks the producer while the ring is full. many sinks may write to
+/// one ring, the source completes once all of them completed (options.producers
+/// of the source). the sink emits no values, a ring error is delivered to error.
+inline auto shm_ring_sink(string name, shm_ring_options options = shm_ring_options{}){
+    info("new shm_ring_sink");
+    return make_lifter([=](auto scbr){
+        info("shm_ring_sink bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("shm_ring_sink bound to context");
+            auto r = scbr.create(ctx);
+            auto writer = make_shared<detail::shm_ring_writer>(name, options);
+            r.lifetime.insert([writer](){
+                writer->stop();
+            });
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto v){
+                    try {
+                        writer->send(detail::to_buffer_records(move(v)));
+                    } catch(...) {
+                        r.error(current_exception());
+                    }
+                },
+                [=](auto& r, auto e){
+                    try {
+                        writer->fail(detail::error_message(e));
+                    } catch(...) {
+                        // the ring is gone, the original error is still delivered
+                    }
+                    r.error(e);
+                },
+                [=](auto& r){
+                    try {
+                        writer->finish();
+                    } catch(...) {
+                        r.error(current_exception());
+                        return;
+                    }
+                    r.complete();
+                });
+        });
+    });
+}
+
+#endif
+
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief connects to a socket_source and sends records as batch frames within the credit it grants.
+class socket_writer
+{
+public:
+    socket_writer(string path, socket_options options)
+        : path(move(path))
+        , options(options)
+        , credit(0) {
+    }
+
+    /// \brief sends the records, waiting for credit when it runs out.
+    /// \returns false when the writer was stopped.
+    bool send(vector<buffer_chain>& records) {
+        if (!connect()) {
+            return false;
+        }
+        size_t first = 0;
+        while (first < records.size()) {
+            while (credit == 0) {
+                if (!receive_credit()) {
+                    return false;
+                }
+            }
+            // as many records as the credit and the frame size allow
+            size_t count = 0;
+            size_t bytes = 1;
+            for (auto i = first; i < records.size() && count < credit; ++i, ++count) {
+                auto size = 4 + records[i].size();
+                if (1 + size > options.max_frame) {
+                    throw frame_error("socket_sink record of " + to_string(records[i].size()) + " bytes is larger than max_frame");
+                }
+                if (bytes + size > options.max_frame) {
+                    break;
+                }
+                bytes += size;
+            }
+            string prefixes(count * 4, '\0');
+            for (size_t i = 0; i < count; ++i) {
+                put_uint32(&prefixes[i * 4], static_cast<uint32_t>(records[first + i].size()));
+            }
+            buffer_slice owner(move(prefixes));
+            buffer_chain body;
+            for (size_t i = 0; i < count; ++i, ++first) {
+                body.append(owner.sub(i * 4, 4));
+                body.append(move(records[first]));
+            }
+            credit -= count;
+            channel->send(socket_batch, body);
+        }
+        return true;
+    }
+
+    void finish() {
+        if (connect()) {
+            channel->send(socket_complete, buffer_chain{});
+            channel.reset();
+        }
+    }
+
+    void fail(const string& what) {
+        if (connect()) {
+            channel->send(socket_failed, buffer_chain(what));
+            channel.reset();
+        }
+    }
+
+    void stop() const {
+        waker.wake();
+    }
+
+private:
+    /// \brief connects on the first call, retrying until the source listens.
+    /// \returns false when the writer was stopped.
+    bool connect() {
+        if (channel) {
+            return true;
+        }
+        auto address = unix_address(path);
+        auto deadline = steady_clock::now() + options.connect_timeout;
+        for (;;) {
+            auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) {
+                throw system_error(errno, system_category(), "socket_sink socket");
+            }
+            close_on_exec(fd);
+            if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+                channel.reset(new socket_channel(fd, options));
+                return true;
+            }
+            auto e = errno;
+            ::close(fd);
+            if ((e != ENOENT && e != ECONNREFUSED && e != EINTR) || steady_clock::now() >= deadline) {
+                throw system_error(e, system_category(), "socket_sink connect " + path);
+            }
+            if (waker.wait(-1, 10) < 0) {
+                return false;
+            }
+        }
+    }
+
+    bool receive_credit() {
+        buffer_chain body;
+        char kind = 0;
+        if (!channel->receive(body, kind, waker)) {
+            return false;
+        }
+        if (kind != socket_credit || body.size() != 4) {
+            throw frame_error("socket_sink unexpected frame");
+        }
+        unsigned char granted[4];
+        body.copy_to(reinterpret_cast<char*>(granted), 4);
+        credit += get_uint32(granted);
+        return true;
+    }
+
+    string path;
+    socket_options options;
+    poll_waker waker;
+    unique_ptr<socket_channel> channel;
+    size_t credit;
+};
+
+}
+
+/// \brief sends each value (buffer_chain, buffer_slice, string or vector<char>) as a
+/// record to the socket_source listening on the unix domain socket at path.
+/// vector values are sent as a batch in one frame, so adaptive_batch in front of
+/// the sink sets the framing. the slices of each record are gathered with sendmsg
+/// and are not copied.
+///
+/// the sink blocks the producer while the source has not granted credit for more
+/// records, which applies the consumer's pace to the producer across processes.
+/// completion and errors are forwarded to the source and then to the observer of the sink.
+/// the sink emits no values, a transport error is delivered to error.
+inline auto socket_sink(string path, socket_options options = socket_options{}){
+    info("new socket_sink");
+    return make_lifter([=](auto scbr){
+        info("socket_sink bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("socket_sink bound to context");
+            auto r = scbr.create(ctx);
+            auto writer = make_shared<detail::socket_writer>(path, options);
+            r.lifetime.insert([writer](){
+                writer->stop();
+            });
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto v){
+                    try {
+                        auto records = detail::to_buffer_records(move(v));
+                        writer->send(records);
+                    } catch(...) {
+                        r.error(current_exception());
+                    }
+                },
+                [=](auto& r, auto e){
+                    try {
+                        writer->fail(detail::error_message(e));
+                    } catch(...) {
+                        // the source is gone, the original error is still delivered
+                    }
+                    r.error(e);
+                },
+                [=](auto& r){
+                    try {
+                        writer->finish();
+                    } catch(...) {
+                        r.error(current_exception());
+                        return;
+                    }
+                    r.complete();
+                });
+        });
+    });
+}
+
+#endif
+
+}
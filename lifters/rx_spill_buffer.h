@@ -0,0 +1,385 @@
+#pragma once
+
+namespace rx {
+
+/// \brief how spill_buffer buffers.
+/// up to window values are held in memory, the values behind them are written to
+/// files of segment bytes in directory. the files are removed as they are created,
+/// so nothing is left behind when the process exits.
+struct spill_options
+{
+    explicit spill_options(size_t window = 4096, string directory = "/tmp", size_t segment = 64 * 1024 * 1024)
+        : window(max<size_t>(window, 1))
+        , directory(move(directory))
+        , segment(max<size_t>(segment, 4096)) {
+    }
+    size_t window;
+    string directory;
+    size_t segment;
+};
+
+/// \brief the default serializer of spill_buffer.
+/// stores trivially copyable values, strings, vectors of trivially copyable
+/// values and buffer chains. another serializer provides the same three members
+/// for the values that it stores.
+struct spill_serializer
+{
+    template<class V>
+    enable_if_t<is_trivially_copyable<V>::value, size_t> size(const V& ) const {
+        return sizeof(V);
+    }
+    template<class V>
+    enable_if_t<is_trivially_copyable<V>::value> save(const V& v, char* out) const {
+        memcpy(out, addressof(v), sizeof(V));
+    }
+
+    size_t size(const string& v) const {
+        return v.size();
+    }
+    void save(const string& v, char* out) const {
+        memcpy(out, v.data(), v.size());
+    }
+
+    template<class T>
+    enable_if_t<is_trivially_copyable<T>::value, size_t> size(const vector<T>& v) const {
+        return v.size() * sizeof(T);
+    }
+    template<class T>
+    enable_if_t<is_trivially_copyable<T>::value> save(const vector<T>& v, char* out) const {
+        memcpy(out, v.data(), v.size() * sizeof(T));
+    }
+
+    size_t size(const buffer_chain& v) const {
+        return v.size();
+    }
+    void save(const buffer_chain& v, char* out) const {
+        v.copy_to(out, v.size());
+    }
+
+    /// \returns the value that save stored in the size bytes at in
+    template<class V>
+    V load(const char* in, size_t size) const {
+        return load(in, size, static_cast<V*>(nullptr));
+    }
+
+private:
+    template<class V>
+    enable_if_t<is_trivially_copyable<V>::value, V> load(const char* in, size_t , V* ) const {
+        V v;
+        memcpy(addressof(v), in, sizeof(V));
+        return v;
+    }
+    string load(const char* in, size_t size, string* ) const {
+        return string(in, size);
+    }
+    template<class T>
+    enable_if_t<is_trivially_copyable<T>::value, vector<T>> load(const char* in, size_t size, vector<T>* ) const {
+        vector<T> v(size / sizeof(T));
+        memcpy(v.data(), in, v.size() * sizeof(T));
+        return v;
+    }
+    buffer_chain load(const char* in, size_t size, buffer_chain* ) const {
+        return buffer_chain(string(in, size));
+    }
+};
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief an append-only sequence of records in memory mapped files.
+/// the pages are backed by the files, so the kernel writes them out instead
+/// of keeping them in memory. each drained file is released.
+class spill_file
+{
+public:
+    spill_file(string directory, size_t segment_size)
+        : directory(move(directory))
+        , segment_size(segment_size)
+        , count(0) {
+    }
+    spill_file(const spill_file&) = delete;
+    spill_file& operator=(const spill_file&) = delete;
+
+    /// \returns the size bytes of a new record at the end
+    char* append(size_t size) {
+        auto space = record_space(size);
+        if (segments.empty() || segments.back()->capacity - segments.back()->tail < space) {
+            if (count == 0) {
+                // the empty file is too small for the record
+                segments.clear();
+            }
+            segments.push_back(make_segment(space));
+        }
+        auto& s = *segments.back();
+        auto at = s.base + s.tail;
+        uint64_t length = size;
+        memcpy(at, &length, sizeof(length));
+        s.tail += space;
+        ++count;
+        return at + sizeof(length);
+    }
+
+    /// \brief the first record, valid until pop
+    void front(const char*& data, size_t& size) const {
+        auto& s = *segments.front();
+        uint64_t length;
+        memcpy(&length, s.base + s.head, sizeof(length));
+        data = s.base + s.head + sizeof(length);
+        size = static_cast<size_t>(length);
+    }
+
+    void pop() {
+        auto& s = *segments.front();
+        const char* data;
+        size_t size;
+        front(data, size);
+        s.head += record_space(size);
+        --count;
+        if (s.head < s.tail) {
+            return;
+        }
+        if (segments.size() > 1) {
+            segments.pop_front();
+        } else {
+            // the last file is written again from its start
+            s.head = s.tail = 0;
+        }
+    }
+
+    size_t records() const {
+        return count;
+    }
+
+private:
+    struct segment
+    {
+        segment() : fd(-1), base(nullptr), capacity(0), head(0), tail(0) {}
+        ~segment() {
+            if (base) {
+                ::munmap(base, capacity);
+            }
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        int fd;
+        char* base;
+        size_t capacity;
+        size_t head;
+        size_t tail;
+    };
+
+    /// a record is a 64 bit length followed by the value, padded to 8 bytes
+    static size_t record_space(size_t size) {
+        return sizeof(uint64_t) + ((size + 7) & ~size_t(7));
+    }
+
+    unique_ptr<segment> make_segment(size_t space) {
+        auto s = make_unique<segment>();
+        auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        s->capacity = (max(space, segment_size) + page - 1) / page * page;
+        auto path = directory + "/rx-spill-XXXXXX";
+        s->fd = ::mkstemp(&path[0]);
+        if (s->fd < 0) {
+            throw system_error(errno, system_category(), "spill_buffer create " + path);
+        }
+        ::unlink(path.c_str());
+        close_on_exec(s->fd);
+        if (::ftruncate(s->fd, static_cast<off_t>(s->capacity)) != 0) {
+            throw system_error(errno, system_category(), "spill_buffer size " + path);
+        }
+        auto base = ::mmap(nullptr, s->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+        if (base == MAP_FAILED) {
+            throw system_error(errno, system_category(), "spill_buffer map " + path);
+        }
+        s->base = static_cast<char*>(base);
+        return s;
+    }
+
+    string directory;
+    size_t segment_size;
+    size_t count;
+    deque<unique_ptr<segment>> segments;
+};
+
+/// \brief the values waiting for the strand, the oldest are in memory and the rest in the spill file.
+template<class Value, class Serializer>
+struct spill_queue
+{
+    spill_queue(const spill_options& options, Serializer serializer)
+        : window(options.window)
+        , serializer(move(serializer))
+        , spilled(options.directory, options.segment) {
+    }
+
+    void push(Value&& v) {
+        if (spilled.records() == 0 && memory.size() < window) {
+            memory.push_back(move(v));
+            return;
+        }
+        auto size = serializer.size(v);
+        serializer.save(v, spilled.append(size));
+    }
+
+    /// \brief moves up to window values, in order, to out.
+    void take(deque<Value>& out) {
+        if (!memory.empty()) {
+            swap(out, memory);
+            return;
+        }
+        while (spilled.records() > 0 && out.size() < window) {
+            const char* data;
+            size_t size;
+            spilled.front(data, size);
+            out.push_back(serializer.template load<Value>(data, size));
+            spilled.pop();
+        }
+    }
+
+    size_t window;
+    Serializer serializer;
+    deque<Value> memory;
+    spill_file spilled;
+};
+
+struct spill_state
+{
+    spill_state() : scheduled(false), finished(false) {}
+    mutex lock;
+    /// a drain is scheduled or running
+    bool scheduled;
+    /// complete or error arrived, it is delivered after the values
+    bool finished;
+    exception_ptr error;
+    /// spill_queue<Value, Serializer>
+    late_bound queue;
+};
+
+template<class Observer>
+void spill_finish(const Observer& r, exception_ptr error) {
+    if (error) {
+        r.error(error);
+    } else {
+        r.complete();
+    }
+}
+
+}
+
+/// \brief delivers values on the strand from makeStrand, like observe_on, without
+/// holding a backlog in memory. up to options.window values wait in memory, the
+/// values behind them are serialized into memory mapped files and read back in
+/// order as the strand catches up. a burst that is larger than memory is kept
+/// until it is delivered, no value is dropped.
+///
+/// serializer stores the values in the files, it has
+///   size_t size(const V&), void save(const V&, char* out) and V load<V>(const char* in, size_t size).
+/// a failure to spill is delivered to error after the values that were buffered,
+/// so is a value of a second type, which could not be kept in order with the first.
+template<class MakeStrand, class Serializer = spill_serializer>
+auto spill_buffer(MakeStrand makeStrand, spill_options options = spill_options{}, Serializer serializer = Serializer{}){
+    info("new spill_buffer");
+    return make_lifter([=](auto scbr){
+        info("spill_buffer bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("spill_buffer bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto outcontext = copy_context(ctx.lifetime, makeStrand, ctx);
+            auto r = scbr.create(outcontext);
+            auto spill = make_state<detail::spill_state>(ctx.lifetime);
+            // error and complete are deferred directly when no drain is scheduled
+            auto finish = [=](exception_ptr e){
+                auto& s = spill.get();
+                unique_lock<mutex> guard(s.lock);
+                if (s.finished) {
+                    return;
+                }
+                s.finished = true;
+                s.error = e;
+                if (s.scheduled) {
+                    return;
+                }
+                guard.unlock();
+                defer(outcontext, make_observer(r, subscription{}, [=](auto& r, auto& ){
+                    detail::spill_finish(r, e);
+                }, detail::pass{}, detail::skip{}));
+            };
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    using value_type = decay_t<decltype(v)>;
+                    using queue_type = detail::spill_queue<value_type, Serializer>;
+                    auto& s = spill.get();
+                    unique_lock<mutex> guard(s.lock);
+                    if (s.finished) {
+                        return;
+                    }
+                    if (s.queue.template holds_other<queue_type>()) {
+                        guard.unlock();
+                        finish(make_exception_ptr(logic_error("spill_buffer values must all have one type")));
+                        return;
+                    }
+                    try {
+                        s.queue.template get<queue_type>(options, serializer).push(move(v));
+                    } catch(...) {
+                        guard.unlock();
+                        finish(current_exception());
+                        return;
+                    }
+                    if (s.scheduled) {
+                        return;
+                    }
+                    s.scheduled = true;
+                    guard.unlock();
+                    auto drain = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                        auto& s = spill.get();
+                        deque<value_type> values;
+                        unique_lock<mutex> guard(s.lock);
+                        for (;;) {
+                            exception_ptr failed;
+                            try {
+                                s.queue.template get<queue_type>(options, serializer).take(values);
+                            } catch(...) {
+                                failed = current_exception();
+                            }
+                            if (failed) {
+                                s.finished = true;
+                                s.error = failed;
+                            }
+                            if (values.empty() || failed) {
+                                s.scheduled = false;
+                                auto finished = s.finished;
+                                auto error = s.error;
+                                guard.unlock();
+                                if (finished) {
+                                    detail::spill_finish(r, error);
+                                }
+                                return;
+                            }
+                            guard.unlock();
+                            for (auto& v : values) {
+                                if (r.lifetime.is_stopped()) {
+                                    return;
+                                }
+                                r.next(move(v));
+                            }
+                            values.clear();
+                            guard.lock();
+                        }
+                    }, detail::pass{}, detail::skip{});
+                    defer(outcontext, drain);
+                },
+                [=](auto& , auto e){
+                    finish(e);
+                },
+                [=](auto& ){
+                    finish(exception_ptr{});
+                });
+        });
+    });
+}
+
+#endif
+
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief appends row groups to a columnar file with one writev for each group.
+/// the footer is written by finish(), a file without a footer is not readable.
+class columnar_writer
+{
+public:
+    explicit columnar_writer(string path)
+        : path(move(path))
+        , fd(::open(this->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+        , offset(0)
+        , groups(0) {
+        if (fd < 0) {
+            throw system_error(errno, system_category(), "write_columnar open " + this->path);
+        }
+        const uint64_t header[] = {columnar_magic, 0};
+        write_all(header, sizeof(header));
+    }
+    ~columnar_writer() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    columnar_writer(const columnar_writer&) = delete;
+    columnar_writer& operator=(const columnar_writer&) = delete;
+
+    template<class... Tn>
+    void append(const record_batch<Tn...>& batch) {
+        if (batch.selected) {
+            append(batch.compacted(), make_index_sequence<sizeof...(Tn)>{});
+        } else {
+            append(batch, make_index_sequence<sizeof...(Tn)>{});
+        }
+    }
+
+    void finish() {
+        footer.insert(footer.begin(), sizes.begin(), sizes.end());
+        footer.insert(footer.begin(), groups);
+        footer.insert(footer.begin(), sizes.size());
+        footer.push_back(offset);
+        footer.push_back(columnar_magic);
+        write_all(footer.data(), footer.size() * sizeof(uint64_t));
+        auto result = ::close(fd);
+        fd = -1;
+        if (result != 0) {
+            throw system_error(errno, system_category(), "write_columnar close " + path);
+        }
+    }
+
+private:
+    template<class... Tn, size_t... In>
+    void append(const record_batch<Tn...>& batch, index_sequence<In...>) {
+        const uint64_t value_sizes[] = {sizeof(Tn)...};
+        if (groups == 0) {
+            sizes.assign(value_sizes, value_sizes + sizeof...(Tn));
+        } else if (sizes != vector<uint64_t>(value_sizes, value_sizes + sizeof...(Tn))) {
+            throw columnar_format_error("write_columnar every batch must have the same schema");
+        }
+        iov.clear();
+        footer.push_back(batch.rows);
+        auto at = offset;
+        int unpack[] = {0, (add(get_column<In>(batch), batch.rows, at), 0)...};
+        (void)unpack;
+        write_all(iov);
+        ++groups;
+    }
+
+    template<class T>
+    void add(const column<T>& c, uint64_t rows, uint64_t& at) {
+        static_assert(is_trivially_copyable<T>::value, "write_columnar column types must be trivially copyable");
+        static_assert(!is_same<T, bool>::value, "write_columnar bool columns are packed by vector<bool>, use uint8_t");
+        static const uint64_t padding[1] = {0};
+        auto range = columnar_range(c, typename is_arithmetic<T>::type{});
+        columnar_chunk chunk{at, 0, c.null_count(), range.first, range.second};
+        auto bytes = rows * sizeof(T);
+        push(c.data(), bytes, at);
+        push(padding, columnar_padded(bytes) - bytes, at);
+        if (c.validity_data()) {
+            chunk.validity = at;
+            push(c.validity_data(), ((rows + 63) / 64) * 8, at);
+        }
+        const size_t count = sizeof(columnar_chunk) / sizeof(uint64_t);
+        uint64_t words[count];
+        memcpy(words, &chunk, sizeof(chunk));
+        footer.insert(footer.end(), words, words + count);
+    }
+
+    void push(const void* data, size_t bytes, uint64_t& at) {
+        if (bytes > 0) {
+            iov.push_back(iovec{const_cast<void*>(data), bytes});
+            at += bytes;
+        }
+    }
+
+    void write_all(const void* data, size_t bytes) {
+        iov.assign(1, iovec{const_cast<void*>(data), bytes});
+        write_all(iov);
+    }
+
+    void write_all(vector<iovec>& buffers) {
+        uint64_t bytes = 0;
+        for (auto& b : buffers) {
+            bytes += b.iov_len;
+        }
+        writev_all(fd, buffers, "write_columnar write " + path);
+        offset += bytes;
+    }
+
+    string path;
+    int fd;
+    uint64_t offset;
+    uint64_t groups;
+    vector<uint64_t> sizes;
+    vector<uint64_t> footer;
+    vector<iovec> iov;
+};
+
+}
+
+/// \brief writes each record_batch as a row group of a columnar file at path and then passes it on.
+/// the columns of each batch are written with one writev, the footer with the row
+/// counts, block offsets and min/max of each column is written when the source completes.
+/// a failed write is delivered to error. read_columnar scans the file.
+inline auto write_columnar(string path){
+    info("new write_columnar");
+    return make_lifter([=](auto scbr){
+        info("write_columnar bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("write_columnar bound to context");
+            auto r = scbr.create(ctx);
+            auto writer = make_state<unique_ptr<detail::columnar_writer>>(ctx.lifetime);
+            return make_observer(r, r.lifetime,
+                [=](auto& r, auto batch){
+                    try {
+                        auto& w = writer.get();
+                        if (!w) {
+                            w.reset(new detail::columnar_writer(path));
+                        }
+                        w->append(batch);
+                    } catch(...) {
+                        r.error(current_exception());
+                        return;
+                    }
+                    r.next(move(batch));
+                },
+                detail::pass{},
+                [=](auto& r){
+                    try {
+                        auto& w = writer.get();
+                        if (!w) {
+                            w.reset(new detail::columnar_writer(path));
+                        }
+                        w->finish();
+                    } catch(...) {
+                        r.error(current_exception());
+                        return;
+                    }
+                    r.complete();
+                });
+        });
+    });
+}
+
+#endif
+
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief writes chunks to a file on the file_io threads.
+/// the chunks that arrive while a write is running are gathered into the next
+/// pwritev, so a fast producer is written in a few large writes.
+class file_writer
+{
+public:
+    file_writer(string path, write_options options, shared_ptr<file_io> io)
+        : path(move(path))
+        , options(options)
+        , io(move(io))
+        , fd(-1)
+        , offset(0)
+        , queued(0)
+        , writing(false)
+        , finishing(false) {
+    }
+    ~file_writer() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    file_writer(const file_writer&) = delete;
+    file_writer& operator=(const file_writer&) = delete;
+
+    /// \brief queues the chunk, waiting while more than write_behind bytes are queued.
+    /// throws the error of an earlier write.
+    void write(const shared_ptr<file_writer>& self, buffer_chain chunk) {
+        unique_lock<mutex> guard(lock);
+        room.wait(guard, [&](){return queued < options.write_behind || !!failed;});
+        if (failed) {
+            rethrow_exception(failed);
+        }
+        queued += chunk.size();
+        pending.append(move(chunk));
+        if (!writing) {
+            writing = true;
+            io->submit([self](){
+                self->drain();
+            });
+        }
+    }
+
+    /// \brief calls settled once the queued chunks are written and the file is closed.
+    void finish(function<void(exception_ptr)> f) {
+        unique_lock<mutex> guard(lock);
+        finishing = true;
+        settled = move(f);
+        if (!writing) {
+            guard.unlock();
+            close();
+        }
+    }
+
+private:
+    void open() {
+        if (fd >= 0) {
+            return;
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (options.append ? 0 : O_TRUNC), 0644);
+        if (fd < 0) {
+            throw system_error(errno, system_category(), "write_file open " + path);
+        }
+        if (options.append) {
+            offset = static_cast<uint64_t>(::lseek(fd, 0, SEEK_END));
+        }
+    }
+
+    /// runs on a file_io thread until nothing is queued
+    void drain() {
+        vector<iovec> buffers;
+        unique_lock<mutex> guard(lock);
+        for (;;) {
+            auto batch = move(pending);
+            pending = buffer_chain{};
+            guard.unlock();
+            exception_ptr error;
+            try {
+                open();
+                buffers.clear();
+                batch.append_iovecs(buffers);
+                write_at(buffers);
+            } catch(...) {
+                error = current_exception();
+            }
+            guard.lock();
+            queued -= batch.size();
+            if (error && !failed) {
+                failed = error;
+            }
+            room.notify_all();
+            if (pending.empty() || failed) {
+                writing = false;
+                if (finishing) {
+                    guard.unlock();
+                    close();
+                }
+                return;
+            }
+        }
+    }
+
+    void write_at(vector<iovec>& buffers) {
+        size_t first = 0;
+        while (first < buffers.size()) {
+            auto count = static_cast<int>(min<size_t>(buffers.size() - first, IOV_MAX));
+            auto written = ::pwritev(fd, buffers.data() + first, count, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw system_error(errno, system_category(), "write_file write " + path);
+            }
+            offset += static_cast<uint64_t>(written);
+            advance_iovecs(buffers, first, static_cast<size_t>(written));
+        }
+    }
+
+    void close() {
+        exception_ptr error;
+        function<void(exception_ptr)> f;
+        {
+            unique_lock<mutex> guard(lock);
+            error = failed;
+            f = move(settled);
+            settled = nullptr;
+        }
+        if (!f) {
+            return;
+        }
+        try {
+            // a file that was never written is still created
+            open();
+            if (options.sync && ::fsync(fd) != 0) {
+                throw system_error(errno, system_category(), "write_file sync " + path);
+            }
+            auto result = ::close(fd);
+            fd = -1;
+            if (result != 0) {
+                throw system_error(errno, system_category(), "write_file close " + path);
+            }
+        } catch(...) {
+            if (!error) {
+                error = current_exception();
+            }
+        }
+        f(error);
+    }
+
+    string path;
+    write_options options;
+    shared_ptr<file_io> io;
+    int fd;
+    uint64_t offset;
+    mutex lock;
+    condition_variable room;
+    buffer_chain pending;
+    size_t queued;
+    bool writing;
+    bool finishing;
+    exception_ptr failed;
+    function<void(exception_ptr)> settled;
+};
+
+}
+
+/// \brief writes each value (buffer_chain, buffer_slice, string or vector<char>) to the
+/// file at path, in order, on the io threads. the values that arrive while a write is
+/// running are gathered into the next pwritev. the producer is not blocked by the
+/// disk unless it is more than options.write_behind bytes ahead of it.
+/// emits no values. completes, or delivers the first write error, once every value
+/// is written and the file is closed, this may be on one of the io threads.
+inline auto write_file(string path, shared_ptr<file_io> io, write_options options = write_options{}){
+    info("new write_file");
+    return make_lifter([=](auto scbr){
+        info("write_file bound to subscriber");
+        return make_subscriber([=](auto ctx){
+            info("write_file bound to context");
+            // the writes outlive the source, r is completed after the source is done
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto r = scbr.create(ctx);
+            auto writer = make_shared<detail::file_writer>(path, options, io);
+            return make_observer(r, lifetime,
+                [=](auto& r, auto v){
+                    try {
+                        writer->write(writer, detail::to_buffer_chain(move(v)));
+                    } catch(...) {
+                        r.error(current_exception());
+                    }
+                },
+                [=](auto& r, auto e){
+                    writer->finish([r, e](exception_ptr){
+                        r.error(e);
+                    });
+                },
+                [=](auto& r){
+                    writer->finish([r](exception_ptr error){
+                        if (error) {
+                            r.error(error);
+                        } else {
+                            r.complete();
+                        }
+                    });
+                });
+        });
+    });
+}
+
+#endif
+
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+namespace rx {
+
+class circuit_open_error : public runtime_error {
+public:
+  explicit circuit_open_error (const string& what_arg) : runtime_error(what_arg) {}
+  explicit circuit_open_error (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+/// \brief the circuit opens when, within the sliding window, at least minimum_calls
+/// finished and the fraction that failed (error or slower than slow_call) reached failure_rate.
+/// while open, calls fail fast for open_duration and then up to probes calls are
+/// let through. a successful probe closes the circuit, a failed probe opens it again.
+struct circuit_breaker_config
+{
+    explicit circuit_breaker_config(double failure_rate = 0.5, long minimum_calls = 20, steady_clock::duration open_duration = 5s, int probes = 1, steady_clock::duration slow_call = 1s, steady_clock::duration window = 10s, int buckets = 10)
+        : failure_rate(failure_rate)
+        , minimum_calls(minimum_calls)
+        , open_duration(open_duration)
+        , probes(probes)
+        , slow_call(slow_call)
+        , window(window)
+        , buckets(buckets) {
+    }
+    double failure_rate;
+    long minimum_calls;
+    steady_clock::duration open_duration;
+    int probes;
+    steady_clock::duration slow_call;
+    steady_clock::duration window;
+    int buckets;
+};
+
+namespace detail {
+
+/// \brief counts outcomes in a ring of time buckets without locks.
+/// a bucket is reset by the first call that claims it for a new epoch,
+/// so the counts are approximate while calls race on a bucket change.
+template<class Clock>
+struct circuit_window
+{
+    using clock_type = decay_t<Clock>;
+    using duration_type = duration_t<clock_type>;
+    using time_point_type = time_point_t<clock_type>;
+
+    struct bucket
+    {
+        bucket() : epoch(-1), successes(0), failures(0) {}
+        atomic<long> epoch;
+        atomic<long> successes;
+        atomic<long> failures;
+    };
+
+    circuit_window(duration_type window, int count)
+        : width(max(duration_type(1), window / max(count, 1)))
+        , count(max(count, 1))
+        , buckets(new bucket[max(count, 1)]) {
+    }
+
+    duration_type width;
+    int count;
+    unique_ptr<bucket[]> buckets;
+
+    long epoch(time_point_type now) const {
+        return static_cast<long>(now.time_since_epoch() / width);
+    }
+
+    void record(time_point_type now, bool failed) {
+        auto e = epoch(now);
+        auto& b = buckets[e % count];
+        auto seen = b.epoch.load();
+        if (seen != e && b.epoch.compare_exchange_strong(seen, e)) {
+            b.successes = 0;
+            b.failures = 0;
+        }
+        ++(failed ? b.failures : b.successes);
+    }
+
+    /// \returns pair of (calls, failures) in the window
+    pair<long, long> totals(time_point_type now) const {
+        auto e = epoch(now);
+        long calls = 0;
+        long failures = 0;
+        for (int i = 0; i < count; ++i) {
+            auto& b = buckets[i];
+            if (e - b.epoch.load() < count) {
+                auto f = b.failures.load();
+                calls += b.successes.load() + f;
+                failures += f;
+            }
+        }
+        return make_pair(calls, failures);
+    }
+
+    void reset() {
+        for (int i = 0; i < count; ++i) {
+            buckets[i].epoch = -1;
+        }
+    }
+};
+
+template<class Clock>
+struct circuit_breaker_state
+{
+    using clock_type = decay_t<Clock>;
+    using duration_type = duration_t<clock_type>;
+    using time_point_type = time_point_t<clock_type>;
+
+    enum class mode : int {closed, open, half_open};
+
+    explicit circuit_breaker_state(const circuit_breaker_config& c)
+        : config(c)
+        , slow_call(duration_cast<duration_type>(c.slow_call))
+        , open_duration(duration_cast<duration_type>(c.open_duration))
+        , window(duration_cast<duration_type>(c.window), c.buckets)
+        , state(pack(mode::closed, time_point_type{}))
+        , probing(0) {
+    }
+
+    circuit_breaker_config config;
+    duration_type slow_call;
+    duration_type open_duration;
+    circuit_window<clock_type> window;
+    /// the mode in the low two bits and the time that the circuit opened above them.
+    /// one word, so that acquire() never sees open with the time of an earlier trip.
+    atomic<uint64_t> state;
+    atomic<int> probing;
+
+    static uint64_t pack(mode m, time_point_type at) {
+        return (static_cast<uint64_t>(at.time_since_epoch().count()) << 2) | static_cast<uint64_t>(m);
+    }
+    static mode mode_of(uint64_t word) {
+        return static_cast<mode>(word & 3);
+    }
+    static duration_type opened_at(uint64_t word) {
+        return duration_type(static_cast<typename duration_type::rep>(static_cast<int64_t>(word) >> 2));
+    }
+
+    /// \returns true when this call moved the circuit from mode from to mode to
+    bool change(mode from, mode to, time_point_type now) {
+        auto word = state.load();
+        if (mode_of(word) != from) {
+            return false;
+        }
+        return state.compare_exchange_strong(word, pack(to, now));
+    }
+
+    /// \returns 0 to fail fast, 1 for a call, 2 for a probe
+    int acquire(time_point_type now) {
+        auto word = state.load();
+        auto m = mode_of(word);
+        if (m == mode::closed) {
+            return 1;
+        }
+        if (m == mode::open) {
+            if (now.time_since_epoch() - opened_at(word) < open_duration) {
+                return 0;
+            }
+            if (state.compare_exchange_strong(word, pack(mode::half_open, now))) {
+                info("circuit_breaker: half-open");
+                probing = 0;
+            }
+        }
+        if (++probing <= config.probes) {
+            return 2;
+        }
+        --probing;
+        return 0;
+    }
+
+    /// \brief a call was stopped without an outcome
+    void release(int permit) {
+        if (permit == 2) {
+            --probing;
+        }
+    }
+
+    void record(int permit, time_point_type start, time_point_type now, bool failed) {
+        failed = failed || (now - start) > slow_call;
+        if (permit == 2) {
+            --probing;
+            if (failed) {
+                if (change(mode::half_open, mode::open, now)) {
+                    info("circuit_breaker: open");
+                }
+            } else if (change(mode::half_open, mode::closed, now)) {
+                window.reset();
+                info("circuit_breaker: closed");
+            }
+            return;
+        }
+        window.record(now, failed);
+        if (!failed || mode_of(state.load()) != mode::closed) {
+            return;
+        }
+        auto totals = window.totals(now);
+        if (totals.first >= config.minimum_calls && totals.second >= config.failure_rate * totals.first) {
+            if (change(mode::closed, mode::open, now)) {
+                info("circuit_breaker: open");
+            }
+        }
+    }
+};
+
+}
+
+/// \brief wraps f, a function that returns an observable for each value (as passed to transform_merge).
+/// calls to f(v) are counted as failed if they end with error or take longer than slow_call.
+/// the statistics are shared by every subscription to every observable returned.
+/// while the circuit is open the returned observable fails fast with circuit_open_error.
+template<class F, class Clock = steady_clock>
+auto circuit_breaker(circuit_breaker_config config, F f) {
+    info("new circuit_breaker");
+    auto breaker = make_shared<detail::circuit_breaker_state<Clock>>(config);
+    return [=](auto v){
+        return make_observable([=](auto scrb){
+            info("circuit_breaker bound to subscriber");
+            return make_starter([=](auto ctx) {
+                info("circuit_breaker bound to context");
+                static_assert(is_same<clock_t<decltype(ctx)>, Clock>::value, "circuit_breaker clock must match the context clock");
+                auto start = ctx.now();
+                auto permit = breaker->acquire(start);
+                if (permit == 0) {
+                    info("circuit_breaker: fail fast");
+                    auto r = scrb.create(ctx);
+                    r.error(make_exception_ptr(circuit_open_error("circuit breaker is open")));
+                    return ctx.lifetime;
+                }
+                auto recorded = make_state<atomic<bool>>(ctx.lifetime, false);
+                ctx.lifetime.insert([=](){
+                    if (!recorded.get().exchange(true)) {
+                        breaker->release(permit);
+                    }
+                });
+                return f(v) |
+                    make_subscriber([=](auto ctx){
+                        auto r = scrb.create(ctx);
+                        return make_observer(r, r.lifetime, detail::noop{},
+                            [=](auto& r, auto e){
+                                if (!recorded.get().exchange(true)) {
+                                    breaker->record(permit, start, ctx.now(), true);
+                                }
+                                r.error(e);
+                            },
+                            [=](auto& r){
+                                if (!recorded.get().exchange(true)) {
+                                    breaker->record(permit, start, ctx.now(), false);
+                                }
+                                r.complete();
+                            });
+                    }) |
+                    ctx;
+            });
+        });
+    };
+}
+
+}
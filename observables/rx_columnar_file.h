@@ -0,0 +1,291 @@
+#pragma once
+
+namespace rx {
+
+class columnar_format_error : public runtime_error {
+public:
+  explicit columnar_format_error (const string& what_arg) : runtime_error(what_arg) {}
+  explicit columnar_format_error (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+/// \brief selects the columns to read from a columnar file and the row groups to skip.
+/// columns lists the file columns in the order of the types passed to read_columnar,
+/// when empty the file columns are read in order.
+/// where(column, min, max) skips each row group whose values in the file column
+/// are all outside [min, max], as recorded in the footer when the file was written.
+struct columnar_scan
+{
+    explicit columnar_scan(vector<size_t> columns = vector<size_t>{})
+        : columns(move(columns)) {
+    }
+    columnar_scan& where(size_t column, double min, double max) {
+        ranges.push_back(range{column, min, max});
+        return *this;
+    }
+    struct range
+    {
+        size_t column;
+        double min;
+        double max;
+    };
+    vector<size_t> columns;
+    vector<range> ranges;
+};
+
+namespace detail {
+
+/// \brief the layout of a columnar file, all fields are 8 bytes.
+///
+///   header:  magic, 0
+///   blocks:  for each row group, for each column: values, padded to 8 bytes,
+///            then the validity bitmap when the column has nulls
+///   footer:  width, groups, value size of each column,
+///            for each row group: rows, then a columnar_chunk for each column
+///   trailer: offset of the footer, magic
+///
+struct columnar_chunk
+{
+    uint64_t values;
+    /// 0 when the column has no nulls in the row group
+    uint64_t validity;
+    uint64_t nulls;
+    /// bounds of the valid values, widened to the nearest double
+    double min;
+    double max;
+};
+
+const uint64_t columnar_magic = 0x31304c4f43585200ull;
+
+inline uint64_t columnar_padded(uint64_t bytes) {
+    return (bytes + 7) & ~uint64_t(7);
+}
+
+/// \brief the bounds of the valid values in c, rounded outward to doubles.
+/// a column with no valid values has an empty range.
+template<class Column>
+pair<double, double> columnar_range(const Column& c, true_type) {
+    auto lo = numeric_limits<double>::infinity();
+    auto hi = -numeric_limits<double>::infinity();
+    bool any = false;
+    using value_type = typename Column::value_type;
+    value_type vmin{}, vmax{};
+    for (size_t row = 0; row < c.size(); ++row) {
+        if (!c.is_valid(row)) {
+            continue;
+        }
+        if (!any || c[row] < vmin) vmin = c[row];
+        if (!any || vmax < c[row]) vmax = c[row];
+        any = true;
+    }
+    if (any) {
+        lo = static_cast<double>(vmin);
+        if (static_cast<long double>(lo) > static_cast<long double>(vmin)) {
+            lo = nextafter(lo, -numeric_limits<double>::infinity());
+        }
+        hi = static_cast<double>(vmax);
+        if (static_cast<long double>(hi) < static_cast<long double>(vmax)) {
+            hi = nextafter(hi, numeric_limits<double>::infinity());
+        }
+    }
+    return make_pair(lo, hi);
+}
+/// values that are not arithmetic have no range and are never skipped
+template<class Column>
+pair<double, double> columnar_range(const Column& , false_type) {
+    return make_pair(-numeric_limits<double>::infinity(), numeric_limits<double>::infinity());
+}
+
+#if RX_POSIX
+
+/// \brief a read-only mapping of a whole file
+struct columnar_mapping
+{
+    columnar_mapping() : base(nullptr), size(0) {}
+    ~columnar_mapping() {
+        if (base) {
+            munmap(const_cast<char*>(base), size);
+        }
+    }
+    const char* base;
+    size_t size;
+};
+
+/// \brief the footer of a mapped columnar file, checked against the size of the file
+class columnar_footer
+{
+public:
+    explicit columnar_footer(const string& path) {
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw system_error(errno, system_category(), "read_columnar open " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            auto e = errno;
+            ::close(fd);
+            throw system_error(e, system_category(), "read_columnar stat " + path);
+        }
+        auto mapping = make_shared<columnar_mapping>();
+        mapping->size = static_cast<size_t>(st.st_size);
+        if (mapping->size < 32) {
+            ::close(fd);
+            throw columnar_format_error("read_columnar file is too small " + path);
+        }
+        auto base = mmap(nullptr, mapping->size, PROT_READ, MAP_SHARED, fd, 0);
+        auto e = errno;
+        // the mapping keeps the file open
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            throw system_error(e, system_category(), "read_columnar mmap " + path);
+        }
+        mapping->base = static_cast<const char*>(base);
+        madvise(base, mapping->size, MADV_SEQUENTIAL);
+        owner = mapping;
+        file = mapping->base;
+        size = mapping->size;
+
+        if (word(0) != columnar_magic || word(size - 8) != columnar_magic) {
+            throw columnar_format_error("read_columnar not a columnar file " + path);
+        }
+        auto footer = word(size - 16);
+        if (footer < 16 || footer > size - 32) {
+            throw columnar_format_error("read_columnar footer out of range " + path);
+        }
+        width = word(footer);
+        groups = word(footer + 8);
+        auto sizes = footer + 16;
+        auto chunks = sizes + 8 * width;
+        auto stride = 8 + sizeof(columnar_chunk) * width;
+        if (width > size / 8 || groups > size / stride || chunks + groups * stride > size - 16) {
+            throw columnar_format_error("read_columnar footer is corrupt " + path);
+        }
+        for (uint64_t c = 0; c < width; ++c) {
+            value_sizes.push_back(word(sizes + 8 * c));
+        }
+        for (uint64_t g = 0; g < groups; ++g) {
+            auto at = chunks + g * stride;
+            auto rows = word(at);
+            row_counts.push_back(rows);
+            for (uint64_t c = 0; c < width; ++c) {
+                columnar_chunk chunk;
+                memcpy(&chunk, file + at + 8 + c * sizeof(columnar_chunk), sizeof(chunk));
+                if (value_sizes[c] != 0 && rows > size / value_sizes[c]) {
+                    throw columnar_format_error("read_columnar row count is corrupt " + path);
+                }
+                if (!in_file(chunk.values, rows * value_sizes[c], footer) ||
+                    (chunk.validity != 0 && !in_file(chunk.validity, ((rows + 63) / 64) * 8, footer)) ||
+                    chunk.values % 8 != 0 || chunk.validity % 8 != 0) {
+                    throw columnar_format_error("read_columnar column block is corrupt " + path);
+                }
+                this->chunks.push_back(chunk);
+            }
+        }
+    }
+
+    shared_ptr<const void> owner;
+    const char* file;
+    uint64_t size;
+    uint64_t width;
+    uint64_t groups;
+    vector<uint64_t> value_sizes;
+    vector<uint64_t> row_counts;
+    /// groups * width chunks
+    vector<columnar_chunk> chunks;
+
+    const columnar_chunk& chunk(uint64_t group, uint64_t column) const {
+        return chunks[group * width + column];
+    }
+
+private:
+    uint64_t word(uint64_t at) const {
+        uint64_t w;
+        memcpy(&w, file + at, sizeof(w));
+        return w;
+    }
+    bool in_file(uint64_t at, uint64_t bytes, uint64_t end) const {
+        return at >= 16 && at <= end && bytes <= end - at;
+    }
+};
+
+template<class T>
+column_view<T> columnar_column(const columnar_footer& f, uint64_t group, uint64_t column) {
+    auto& chunk = f.chunk(group, column);
+    auto validity = chunk.validity == 0 ? nullptr : reinterpret_cast<const uint64_t*>(f.file + chunk.validity);
+    return column_view<T>(reinterpret_cast<const T*>(f.file + chunk.values), validity, f.row_counts[group], chunk.nulls, f.owner);
+}
+
+template<class... Tn, size_t... In>
+record_batch_view<Tn...> columnar_group(const columnar_footer& f, uint64_t group, const vector<size_t>& columns, index_sequence<In...>) {
+    record_batch_view<Tn...> batch;
+    batch.columns = typename record_batch_view<Tn...>::columns_type{columnar_column<Tn>(f, group, columns[In])...};
+    batch.rows = f.row_counts[group];
+    return batch;
+}
+
+#endif
+
+}
+
+#if RX_POSIX
+
+/// \brief emits a record_batch_view for each row group in a file written by write_columnar.
+/// the file is mapped and the views point into the mapping, so the columns are not
+/// copied and the columns that are not listed in scan are never read.
+/// the types Tn must be trivially copyable and have the sizes recorded in the file.
+template<class... Tn>
+auto read_columnar(string path, columnar_scan scan = columnar_scan{}){
+    info("new read_columnar");
+    static_assert(detail::all_true<is_trivially_copyable<Tn>::value...>::value, "read_columnar types must be trivially copyable");
+    return make_observable([=](auto scrb){
+        info("read_columnar bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("read_columnar bound to context");
+            auto r = scrb.create(ctx);
+            unique_ptr<detail::columnar_footer> footer;
+            auto columns = scan.columns;
+            try {
+                footer.reset(new detail::columnar_footer(path));
+                if (columns.empty()) {
+                    for (size_t c = 0; c < sizeof...(Tn); ++c) {
+                        columns.push_back(c);
+                    }
+                }
+                const size_t sizes[] = {sizeof(Tn)...};
+                if (columns.size() != sizeof...(Tn)) {
+                    throw columnar_format_error("read_columnar needs one column for each type");
+                }
+                for (size_t i = 0; i < columns.size() && footer->groups > 0; ++i) {
+                    if (columns[i] >= footer->width || footer->value_sizes[columns[i]] != sizes[i]) {
+                        throw columnar_format_error("read_columnar column " + to_string(columns[i]) + " does not match the file");
+                    }
+                }
+                for (auto& range : scan.ranges) {
+                    if (range.column >= footer->width && footer->groups > 0) {
+                        throw columnar_format_error("read_columnar where column " + to_string(range.column) + " is not in the file");
+                    }
+                }
+            } catch(...) {
+                r.error(current_exception());
+                return ctx.lifetime;
+            }
+            info("read_columnar started");
+            for (uint64_t g = 0; g < footer->groups && !r.lifetime.is_stopped(); ++g) {
+                auto skip = false;
+                for (auto& range : scan.ranges) {
+                    auto& chunk = footer->chunk(g, range.column);
+                    skip = skip || chunk.max < range.min || range.max < chunk.min;
+                }
+                if (skip) {
+                    continue;
+                }
+                r.next(detail::columnar_group<Tn...>(*footer, g, columns, make_index_sequence<sizeof...(Tn)>{}));
+            }
+            r.complete();
+            return ctx.lifetime;
+        });
+    });
+}
+
+#endif
+
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+namespace rx {
+
+class merge_join_overflow : public runtime_error {
+public:
+  explicit merge_join_overflow (const string& what_arg) : runtime_error(what_arg) {}
+  explicit merge_join_overflow (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+namespace detail {
+
+/// \brief joins two queues that are sorted by key.
+/// only the values of the current key run are kept after they are matched.
+template<class L, class R, class Key>
+struct merge_join_state
+{
+    using lock_type = mutex;
+    using guard_type = unique_lock<lock_type>;
+    using pair_type = pair<L, R>;
+
+    explicit merge_join_state(size_t capacity)
+        : capacity(capacity)
+        , left_done(false)
+        , right_done(false)
+        , draining(false)
+        , finished(false)
+        , run(false) {
+    }
+
+    lock_type lock;
+    condition_variable consumed;
+    size_t capacity;
+
+    deque<L> left;
+    deque<R> right;
+    bool left_done;
+    bool right_done;
+    /// the thread that pushed the last value of each side, id() before the first
+    thread::id left_producer;
+    thread::id right_producer;
+
+    /// a thread is delivering the output
+    bool draining;
+    bool finished;
+    function<void()> fail;
+
+    bool run;
+    Key key;
+    vector<L> left_run;
+    vector<R> right_run;
+
+    static bool equal(const Key& lhs, const Key& rhs) {
+        return !(lhs < rhs) && !(rhs < lhs);
+    }
+
+    /// \brief waits while the side is at capacity and the join can still make progress without it.
+    /// only a producer on a different thread than the other side can wait, the other side
+    /// could not push while this thread waits. before the other side has produced there is
+    /// no thread known that could make room.
+    /// \returns false when the side is full and waiting could never end.
+    template<class Side>
+    bool wait_for_room(guard_type& guard, const Side& side, thread::id other) {
+        if (capacity == 0 || side.size() < capacity) {
+            return true;
+        }
+        if (other == thread::id{} || other == this_thread::get_id()) {
+            return false;
+        }
+        consumed.wait(guard, [&](){
+            return side.size() < capacity || finished || left_done || right_done;
+        });
+        return true;
+    }
+
+    /// \brief matches as many queued values as possible.
+    /// \returns true when no further pairs can be produced.
+    template<class KeyLeft, class KeyRight>
+    bool step(const KeyLeft& key_left, const KeyRight& key_right, vector<pair_type>& out) {
+        for (;;) {
+            if (run) {
+                if (!left.empty() && equal(key_left(left.front()), key)) {
+                    for (auto& r : right_run) {
+                        out.emplace_back(left.front(), r);
+                    }
+                    left_run.push_back(move(left.front()));
+                    left.pop_front();
+                    continue;
+                }
+                if (!right.empty() && equal(key_right(right.front()), key)) {
+                    for (auto& l : left_run) {
+                        out.emplace_back(l, right.front());
+                    }
+                    right_run.push_back(move(right.front()));
+                    right.pop_front();
+                    continue;
+                }
+                auto left_past = !left.empty() || left_done;
+                auto right_past = !right.empty() || right_done;
+                if (!left_past || !right_past) {
+                    return false;
+                }
+                run = false;
+                left_run.clear();
+                right_run.clear();
+                continue;
+            }
+            if ((left.empty() && left_done) || (right.empty() && right_done)) {
+                left.clear();
+                right.clear();
+                return true;
+            }
+            if (left.empty() || right.empty()) {
+                return false;
+            }
+            auto kl = key_left(left.front());
+            auto kr = key_right(right.front());
+            if (kl < kr) {
+                left.pop_front();
+            } else if (kr < kl) {
+                right.pop_front();
+            } else {
+                run = true;
+                key = move(kl);
+            }
+        }
+    }
+};
+
+}
+
+/// \brief inner join of two observables that are both sorted by key.
+/// emits pair(l, r) for each left value and right value with equal keys.
+/// the side with the smaller key is advanced and values that cannot match
+/// are discarded, so only the values of the current key run are kept.
+/// key_left and key_right must take the value type of their side (not auto).
+///
+/// values from the faster side are queued until the slower side catches up.
+/// capacity bounds each queue from the first value, 0 leaves them unbounded.
+/// the producer of a full side is blocked until the join consumes from it when the
+/// other side has produced on a different thread. otherwise merge_join_overflow is
+/// delivered to error: before the other side has produced, for example when a
+/// synchronous left source fills its queue before the right source is subscribed,
+/// and when blocking would stop the other side too, for example when both run on
+/// one strand.
+template<class Left, class Right, class KeyLeft, class KeyRight>
+auto merge_join(Left left, Right right, KeyLeft key_left, KeyRight key_right, size_t capacity = 65536){
+    info("new merge_join");
+    using left_type = detail::callable_argument_t<KeyLeft>;
+    using right_type = detail::callable_argument_t<KeyRight>;
+    using key_type = decay_t<decltype(key_left(declval<const left_type&>()))>;
+    using state_type = detail::merge_join_state<left_type, right_type, key_type>;
+    return make_observable([=](auto scrb){
+        info("merge_join bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("merge_join bound to context");
+            auto r = scrb.create(ctx);
+            auto joined = make_state<state_type>(ctx.lifetime, capacity);
+            auto& j = joined.get();
+            ctx.lifetime.insert([&j](){
+                typename state_type::guard_type guard(j.lock);
+                j.finished = true;
+                j.fail = nullptr;
+                j.consumed.notify_all();
+            });
+
+            // called with the lock held after each change to the queues.
+            // one thread at a time delivers the pairs without the lock held.
+            auto drain = [=](typename state_type::guard_type& guard){
+                auto& j = joined.get();
+                if (j.draining || j.finished) {
+                    return;
+                }
+                j.draining = true;
+                vector<typename state_type::pair_type> out;
+                for (;;) {
+                    auto fail = move(j.fail);
+                    j.fail = nullptr;
+                    auto done = !fail && j.step(key_left, key_right, out);
+                    if (j.capacity > 0) {
+                        // step may have discarded values without producing a pair
+                        j.consumed.notify_all();
+                    }
+                    if (out.empty() && !done && !fail) {
+                        j.draining = false;
+                        return;
+                    }
+                    j.finished = done || !!fail;
+                    guard.unlock();
+                    for (auto& p : out) {
+                        r.next(move(p));
+                    }
+                    out.clear();
+                    if (fail) {
+                        fail();
+                    } else if (done) {
+                        r.complete();
+                    }
+                    guard.lock();
+                    if (j.finished) {
+                        j.draining = false;
+                        return;
+                    }
+                }
+            };
+
+            auto side = [=](auto source, auto push, auto complete){
+                subscription lifetime;
+                ctx.lifetime.insert(lifetime);
+                if (lifetime.is_stopped()) {
+                    return;
+                }
+                source |
+                    make_subscriber([=](auto ctx){
+                        return make_observer(ctx.lifetime,
+                            [=](auto v){
+                                auto& j = joined.get();
+                                typename state_type::guard_type guard(j.lock);
+                                if (!push(j, guard, move(v)) && !j.finished && !j.fail) {
+                                    auto e = make_exception_ptr(merge_join_overflow("merge_join side is full and its producer cannot wait for the other side"));
+                                    j.fail = [r, e](){r.error(e);};
+                                }
+                                drain(guard);
+                            },
+                            [=](auto e){
+                                auto& j = joined.get();
+                                typename state_type::guard_type guard(j.lock);
+                                if (!j.finished && !j.fail) {
+                                    j.fail = [r, e](){r.error(e);};
+                                }
+                                drain(guard);
+                            },
+                            [=](){
+                                auto& j = joined.get();
+                                typename state_type::guard_type guard(j.lock);
+                                complete(j);
+                                j.consumed.notify_all();
+                                drain(guard);
+                            });
+                    }) |
+                    start(lifetime, ctx);
+            };
+
+            side(left,
+                [](state_type& j, typename state_type::guard_type& guard, left_type v){
+                    j.left_producer = this_thread::get_id();
+                    if (!j.wait_for_room(guard, j.left, j.right_producer)) {
+                        return false;
+                    }
+                    j.left.push_back(move(v));
+                    return true;
+                },
+                [](state_type& j){j.left_done = true;});
+            side(right,
+                [](state_type& j, typename state_type::guard_type& guard, right_type v){
+                    j.right_producer = this_thread::get_id();
+                    if (!j.wait_for_room(guard, j.right, j.left_producer)) {
+                        return false;
+                    }
+                    j.right.push_back(move(v));
+                    return true;
+                },
+                [](state_type& j){j.right_done = true;});
+            return ctx.lifetime;
+        });
+    });
+}
+
+}
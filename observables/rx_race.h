@@ -0,0 +1,109 @@
+#pragma once
+
+namespace rx {
+
+namespace detail {
+
+struct race_state
+{
+    using lock_type = mutex;
+    using guard_type = unique_lock<lock_type>;
+
+    race_state() : winner(-1) {}
+
+    /// \brief adds a lifetime to the race.
+    /// \returns the index of the entrant or -1 if the race is already won.
+    int enter(const subscription& entrant) {
+        guard_type guard(lock);
+        if (winner >= 0) {
+            return -1;
+        }
+        entrants.push_back(entrant);
+        return static_cast<int>(entrants.size()) - 1;
+    }
+    /// \brief the first entrant to claim wins and the lifetimes of all the other entrants are stopped.
+    /// \returns true if index is the winner.
+    bool claim(int index) {
+        auto expected = winner.load();
+        if (expected >= 0) {
+            return expected == index;
+        }
+        if (!winner.compare_exchange_strong(expected, index)) {
+            return expected == index;
+        }
+        info("race: won by entrant - " + to_string(index));
+        guard_type guard(lock);
+        auto losers = entrants;
+        guard.unlock();
+        for (int i = 0; i < static_cast<int>(losers.size()); ++i) {
+            if (i != index) {
+                losers[i].stop();
+            }
+        }
+        return true;
+    }
+    bool is_won() const {
+        return winner >= 0;
+    }
+
+    lock_type lock;
+    atomic<int> winner;
+    vector<subscription> entrants;
+};
+
+/// \brief subscribes o as a new entrant in the race.
+/// the first next, error or complete from an entrant wins and the winner is the only entrant forwarded to r.
+template<class Observable, class Observer, class Context>
+void race_start(state<race_state> race, Observable o, Observer r, Context ctx) {
+    subscription lifetime;
+    auto index = race.get().enter(lifetime);
+    if (index < 0) {
+        info("race: entrant arrived after the race was won");
+        return;
+    }
+    ctx.lifetime.insert(lifetime);
+    if (lifetime.is_stopped()) {
+        return;
+    }
+    info("race: entrant started - " + to_string(index));
+    o |
+        make_subscriber([=](auto ctx){
+            info("race-entrant bound to context lifetime - " + to_string(reinterpret_cast<ptrdiff_t>(ctx.lifetime.store.get())));
+            return make_observer(r, ctx.lifetime,
+                [=](auto& r, auto& v){
+                    if (race.get().claim(index)) r.next(v);
+                },
+                [=](auto& r, auto e){
+                    if (race.get().claim(index)) r.error(e);
+                },
+                [=](auto& r){
+                    if (race.get().claim(index)) r.complete();
+                });
+        }) |
+        start(lifetime, ctx);
+}
+
+}
+
+/// \brief subscribes to all the sources and forwards only the first source to emit (amb).
+/// the lifetimes of the losing sources are stopped as soon as the winner emits.
+const auto race = [](auto... on){
+    info("new race");
+    return make_observable([=](auto scrb){
+        info("race bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("race bound to context");
+            auto r = scrb.create(ctx);
+            auto race = make_state<detail::race_state>(ctx.lifetime);
+            info("race started");
+            int unpack[] = {0, (detail::race_start(race, on, r, ctx), 0)...};
+            (void)unpack;
+            if (sizeof...(on) == 0) {
+                r.complete();
+            }
+            return ctx.lifetime;
+        });
+    });
+};
+
+}
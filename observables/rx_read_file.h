@@ -0,0 +1,226 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief reads the chunks of a file on the file_io threads, up to read_ahead
+/// chunks ahead of the delivery. the chunks are delivered in order of their offset.
+class file_reader
+{
+public:
+    struct slot
+    {
+        slot() : done(false) {}
+        bool done;
+        buffer_chain data;
+        exception_ptr error;
+    };
+
+    file_reader(string path, read_options options, shared_ptr<file_io> io)
+        : delivering(false)
+        , stopped(false)
+        , path(move(path))
+        , options(options)
+        , io(move(io))
+        , pool(make_shared<buffer_pool>(options.chunk, options.read_ahead + 1))
+        , fd(-1)
+        , next(options.offset)
+        , end(options.length > numeric_limits<uint64_t>::max() - options.offset ? numeric_limits<uint64_t>::max() : options.offset + options.length)
+        , eof(false) {
+    }
+    ~file_reader() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    file_reader(const file_reader&) = delete;
+    file_reader& operator=(const file_reader&) = delete;
+
+    /// \brief starts reads until read_ahead chunks are outstanding.
+    /// schedule is called when the first outstanding chunk is ready to be delivered.
+    void issue(const shared_ptr<file_reader>& self, unique_lock<mutex>& ) {
+        while (!stopped && !eof && next < end && slots.size() < options.read_ahead) {
+            auto s = make_shared<slot>();
+            auto offset = next;
+            auto size = static_cast<size_t>(min<uint64_t>(options.chunk, end - next));
+            next += size;
+            slots.push_back(s);
+            io->submit([self, s, offset, size](){
+                self->read(*s, offset, size);
+            });
+        }
+    }
+
+    /// \brief moves the chunks that are ready, in order, to ready.
+    /// \returns true when every chunk was taken.
+    bool take(vector<shared_ptr<slot>>& ready, unique_lock<mutex>& ) {
+        while (!slots.empty() && slots.front()->done) {
+            ready.push_back(move(slots.front()));
+            slots.pop_front();
+        }
+        return slots.empty() && (eof || next >= end);
+    }
+
+    size_t outstanding() const {
+        return slots.size();
+    }
+
+    mutex lock;
+    /// a delivery is scheduled or running
+    bool delivering;
+    bool stopped;
+    function<void()> schedule;
+
+private:
+    void read(slot& s, uint64_t offset, size_t size) {
+        buffer_chain data;
+        exception_ptr error;
+        try {
+            call_once(opened, [this](){
+                fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    throw system_error(errno, system_category(), "read_file open " + path);
+                }
+            });
+            data = read_at(offset, size);
+        } catch(...) {
+            error = current_exception();
+        }
+        function<void()> ready;
+        {
+            unique_lock<mutex> guard(lock);
+            s.done = true;
+            s.data = move(data);
+            s.error = error;
+            if (error || s.data.size() < size) {
+                eof = true;
+            }
+            if (!delivering && !stopped && slots.front()->done) {
+                delivering = true;
+                ready = schedule;
+            }
+        }
+        if (ready) {
+            ready();
+        }
+    }
+
+    buffer_chain read_at(uint64_t offset, size_t size) {
+        auto block = pool->allocate();
+        size_t filled = 0;
+        while (filled < size) {
+            auto count = ::pread(fd, block.get() + filled, size - filled, static_cast<off_t>(offset + filled));
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw system_error(errno, system_category(), "read_file read " + path);
+            }
+            if (count == 0) {
+                break;
+            }
+            filled += static_cast<size_t>(count);
+        }
+        return buffer_chain(buffer_slice(shared_ptr<const char>(block), filled));
+    }
+
+    string path;
+    read_options options;
+    shared_ptr<file_io> io;
+    shared_ptr<buffer_pool> pool;
+    once_flag opened;
+    int fd;
+    uint64_t next;
+    uint64_t end;
+    bool eof;
+    deque<shared_ptr<slot>> slots;
+};
+
+}
+
+/// \brief reads the range of the file at path in options and emits it as buffer_chain
+/// chunks, in order. the reads run on the io threads and up to options.read_ahead
+/// chunks are read before they are delivered, the next read starts as a chunk is
+/// delivered. the chunks are delivered on the strand from makeStrand, which is
+/// never blocked by the disk. completes at the end of the range or of the file.
+template<class MakeStrand>
+auto read_file(string path, shared_ptr<file_io> io, MakeStrand makeStrand, read_options options = read_options{}){
+    info("new read_file");
+    return make_observable([=](auto scrb){
+        info("read_file bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("read_file bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto readcontext = copy_context(lifetime, makeStrand, ctx);
+            auto r = scrb.create(ctx);
+            auto reader = make_shared<detail::file_reader>(path, options, io);
+            ctx.lifetime.insert([reader](){
+                unique_lock<mutex> guard(reader->lock);
+                reader->stopped = true;
+                reader->schedule = nullptr;
+            });
+            weak_ptr<detail::file_reader> weak = reader;
+            // runs on the strand, delivers the chunks that are ready and reads more
+            auto deliver = [=](auto& r){
+                auto reader = weak.lock();
+                if (!reader) {
+                    return;
+                }
+                vector<shared_ptr<detail::file_reader::slot>> ready;
+                unique_lock<mutex> guard(reader->lock);
+                for (;;) {
+                    auto finished = reader->take(ready, guard);
+                    if (ready.empty() && !finished) {
+                        reader->delivering = false;
+                        return;
+                    }
+                    guard.unlock();
+                    for (auto& s : ready) {
+                        if (r.lifetime.is_stopped()) {
+                            return;
+                        }
+                        if (s->error) {
+                            r.error(s->error);
+                            return;
+                        }
+                        if (!s->data.empty()) {
+                            r.next(move(s->data));
+                        }
+                    }
+                    ready.clear();
+                    if (finished) {
+                        r.complete();
+                        return;
+                    }
+                    guard.lock();
+                    reader->issue(reader, guard);
+                }
+            };
+            // a deferred observer is completed when it returns, each delivery needs a new one
+            auto schedule = [=](){
+                defer(readcontext, make_observer(r, subscription{}, [=](auto& r, auto& ){
+                    deliver(r);
+                }, detail::pass{}, detail::skip{}));
+            };
+            unique_lock<mutex> guard(reader->lock);
+            reader->schedule = schedule;
+            info("read_file started");
+            reader->issue(reader, guard);
+            if (reader->outstanding() == 0) {
+                // an empty range completes without a read
+                reader->delivering = true;
+                guard.unlock();
+                schedule();
+            }
+            return ctx.lifetime;
+        });
+    });
+}
+
+#endif
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+/// \brief creates a ring buffer in shared memory named name (see shm_open) and
+/// emits each record that shm_ring_sinks, in this or other processes, write to it.
+/// each record is emitted as a buffer_chain. the records are copied from the ring
+/// into pooled blocks in batches, so that the space in the ring is freed for the sinks.
+/// a sink waits while the ring is full, so a slow consumer slows down the sinks.
+/// completes once options.producers sinks have completed and their records were
+/// delivered. an error from any sink is delivered as a remote_error. a sink that
+/// exits without completing, and a ring that another live source holds, are errors.
+///
+/// the ring is read and the records are delivered on the strand from makeStrand.
+/// the strand is blocked while the source runs, so it should be a new_thread.
+template<class MakeStrand>
+auto shm_ring_source(string name, MakeStrand makeStrand, shm_ring_options options = shm_ring_options{}){
+    info("new shm_ring_source");
+    return make_observable([=](auto scrb){
+        info("shm_ring_source bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("shm_ring_source bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto sourcecontext = copy_context(lifetime, makeStrand, ctx);
+            auto r = scrb.create(ctx);
+            shared_ptr<detail::shm_ring> ring;
+            try {
+                ring = make_shared<detail::shm_ring>(name, options);
+            } catch(...) {
+                r.error(current_exception());
+                return ctx.lifetime;
+            }
+            auto stopped = make_shared<atomic<bool>>(false);
+            // stopping lifetime is deferred to the strand, which the source blocks
+            ctx.lifetime.insert([ring, stopped](){
+                *stopped = true;
+                ring->wake();
+            });
+            info("shm_ring_source started");
+            auto serve = [=](auto& r){
+                auto pool = make_shared<buffer_pool>();
+                auto is_stopped = [stopped](){return stopped->load();};
+                vector<buffer_chain> records;
+                string message;
+                while (!is_stopped()) {
+                    records.clear();
+                    size_t count = 0;
+                    try {
+                        count = ring->read(records, *pool, 1024);
+                    } catch(...) {
+                        r.error(current_exception());
+                        return;
+                    }
+                    if (count > 0) {
+                        for (auto& record : records) {
+                            if (r.lifetime.is_stopped()) {
+                                return;
+                            }
+                            r.next(move(record));
+                        }
+                        continue;
+                    }
+                    if (ring->failure(message)) {
+                        r.error(make_exception_ptr(remote_error(message)));
+                        return;
+                    }
+                    if (ring->drained()) {
+                        r.complete();
+                        return;
+                    }
+                    if (ring->abandoned()) {
+                        // the records that the sink committed were delivered
+                        r.error(make_exception_ptr(runtime_error("shm_ring " + name + " sink exited without completing")));
+                        return;
+                    }
+                    ring->wait(is_stopped);
+                }
+            };
+            auto run = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                serve(r);
+                ring->unlink();
+            }, detail::pass{}, detail::skip{});
+            defer(sourcecontext, run);
+            return ctx.lifetime;
+        });
+    });
+}
+
+#endif
+
+}
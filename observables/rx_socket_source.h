@@ -0,0 +1,189 @@
+#pragma once
+
+namespace rx {
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief listens at path, accepts one socket_sink and delivers what it sends.
+/// credit is returned to the sink as the records are delivered.
+class socket_source_session
+{
+public:
+    socket_source_session(string path, socket_options options)
+        : path(move(path))
+        , options(options)
+        , listener(::socket(AF_UNIX, SOCK_STREAM, 0))
+        , delivered(0) {
+        if (listener < 0) {
+            throw system_error(errno, system_category(), "socket_source socket");
+        }
+        close_on_exec(listener);
+        auto address = unix_address(this->path);
+        ::unlink(this->path.c_str());
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, 1) != 0) {
+            auto e = errno;
+            ::close(listener);
+            throw system_error(e, system_category(), "socket_source listen " + this->path);
+        }
+    }
+    ~socket_source_session() {
+        close();
+    }
+    socket_source_session(const socket_source_session&) = delete;
+    socket_source_session& operator=(const socket_source_session&) = delete;
+
+    /// \brief accepts the sink on the first call and then waits for the next frame.
+    /// \returns false when the source was stopped.
+    bool receive(buffer_chain& body, char& kind) {
+        if (!channel) {
+            if (waker.wait(listener) < 0) {
+                return false;
+            }
+            auto fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                throw system_error(errno, system_category(), "socket_source accept " + path);
+            }
+            close_on_exec(fd);
+            channel.reset(new socket_channel(fd, options));
+            channel->send_credit(static_cast<uint32_t>(options.credit));
+        }
+        return channel->receive(body, kind, waker);
+    }
+
+    /// \brief splits a batch frame into its records, the records share the frame's blocks.
+    void split(buffer_chain body, vector<buffer_chain>& records) const {
+        frame_decoder records_of(frame_format(4, options.max_frame));
+        records_of.push(move(body));
+        buffer_chain record;
+        while (records_of.next(record)) {
+            records.push_back(move(record));
+        }
+        if (records_of.partial()) {
+            throw frame_error("socket_source batch frame ends inside a record");
+        }
+    }
+
+    /// \brief returns credit to the sink once half of the window was delivered.
+    void consumed(size_t count) {
+        delivered += count;
+        if (delivered >= (options.credit + 1) / 2) {
+            try {
+                channel->send_credit(static_cast<uint32_t>(delivered));
+            } catch(const system_error&) {
+                // the sink may close after its last frame, a sink that
+                // closed early is reported by the next receive
+            }
+            delivered = 0;
+        }
+    }
+
+    void stop() const {
+        waker.wake();
+    }
+
+    /// \brief closes the sockets and removes path, once the source is finished.
+    void close() {
+        channel.reset();
+        if (listener >= 0) {
+            ::close(listener);
+            ::unlink(path.c_str());
+            listener = -1;
+        }
+    }
+
+private:
+    string path;
+    socket_options options;
+    int listener;
+    poll_waker waker;
+    unique_ptr<socket_channel> channel;
+    size_t delivered;
+};
+
+}
+
+/// \brief listens on the unix domain socket at path for one socket_sink, which
+/// may be in another process, and emits each record it sends as a buffer_chain.
+/// the sink sends no more records than the credit in options until the source
+/// has delivered them, so a slow consumer of the source slows down the sink.
+/// the completion or the error delivered to the sink is delivered here, a
+/// forwarded error is a remote_error. a sink that closes before either is an error.
+///
+/// the socket is read and the records are delivered on the strand from makeStrand.
+/// the strand is blocked while the source runs, so it should be a new_thread.
+template<class MakeStrand>
+auto socket_source(string path, MakeStrand makeStrand, socket_options options = socket_options{}){
+    info("new socket_source");
+    return make_observable([=](auto scrb){
+        info("socket_source bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("socket_source bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto sourcecontext = copy_context(lifetime, makeStrand, ctx);
+            auto r = scrb.create(ctx);
+            shared_ptr<detail::socket_source_session> session;
+            try {
+                session = make_shared<detail::socket_source_session>(path, options);
+            } catch(...) {
+                r.error(current_exception());
+                return ctx.lifetime;
+            }
+            // stopping lifetime is deferred to the strand, which the source blocks
+            ctx.lifetime.insert([session](){
+                session->stop();
+            });
+            info("socket_source started");
+            // transport errors are delivered to error, errors from the observer are not caught
+            auto serve = [=](auto& r){
+                vector<buffer_chain> records;
+                for (;;) {
+                    buffer_chain body;
+                    char kind = 0;
+                    try {
+                        if (!session->receive(body, kind)) {
+                            return;
+                        }
+                        records.clear();
+                        if (kind == detail::socket_batch) {
+                            session->split(move(body), records);
+                        } else if (kind != detail::socket_complete && kind != detail::socket_failed) {
+                            throw frame_error("socket_source unexpected frame");
+                        }
+                    } catch(...) {
+                        r.error(current_exception());
+                        return;
+                    }
+                    if (kind == detail::socket_complete) {
+                        r.complete();
+                        return;
+                    }
+                    if (kind == detail::socket_failed) {
+                        r.error(make_exception_ptr(remote_error(body.str())));
+                        return;
+                    }
+                    for (auto& record : records) {
+                        if (r.lifetime.is_stopped()) {
+                            return;
+                        }
+                        r.next(move(record));
+                    }
+                    session->consumed(records.size());
+                }
+            };
+            auto run = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                serve(r);
+                session->close();
+            }, detail::pass{}, detail::skip{});
+            defer(sourcecontext, run);
+            return ctx.lifetime;
+        });
+    });
+}
+
+#endif
+
+}
@@ -0,0 +1,380 @@
+#pragma once
+
+namespace rx {
+
+/// \brief how tail_file follows a file.
+/// when from_start is false only the data appended after the start is read.
+/// the file is read in chunks of up to chunk bytes. poll is the interval that the
+/// file is checked without a notification (without inotify it is the only check).
+struct tail_options
+{
+    explicit tail_options(bool from_start = false, size_t chunk = 1024 * 1024, milliseconds poll = seconds(1))
+        : from_start(from_start)
+        , chunk(max<size_t>(chunk, 4096))
+        , poll(poll) {
+    }
+    bool from_start;
+    size_t chunk;
+    milliseconds poll;
+};
+
+#if RX_POSIX
+
+namespace detail {
+
+/// \brief reads what is appended to the file at path.
+/// a file that is renamed or removed and then replaced at path (rotation) is
+/// read to the end before the new file is read from its start. a file that is
+/// truncated is read again from its start.
+class file_tail
+{
+public:
+    file_tail(string path, tail_options options)
+        : rotations(0)
+        , path(move(path))
+        , options(options)
+        , pool(make_shared<buffer_pool>(options.chunk, 4))
+        , fd(-1)
+        , inode(0)
+        , offset(0)
+        , opened(false)
+        , notify(-1) {
+        auto slash = this->path.rfind('/');
+        directory = slash == string::npos ? string(".") : this->path.substr(0, max<size_t>(slash, 1));
+        name = slash == string::npos ? this->path : this->path.substr(slash + 1);
+#if defined(__linux__)
+        notify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notify < 0) {
+            throw system_error(errno, system_category(), "tail_file inotify");
+        }
+        // the directory watch follows the name through rotations
+        if (::inotify_add_watch(notify, directory.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB) < 0) {
+            auto e = errno;
+            ::close(notify);
+            throw system_error(e, system_category(), "tail_file watch " + directory);
+        }
+#endif
+        try {
+            open();
+        } catch(...) {
+            if (notify >= 0) {
+                ::close(notify);
+            }
+            throw;
+        }
+        // a file that appears after the start is read from its start
+        opened = true;
+    }
+    ~file_tail() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (notify >= 0) {
+            ::close(notify);
+        }
+    }
+    file_tail(const file_tail&) = delete;
+    file_tail& operator=(const file_tail&) = delete;
+
+    /// \brief waits until data is appended and reads it.
+    /// \returns false when stopped.
+    bool next(vector<buffer_chain>& chunks) {
+        for (;;) {
+            if (fd < 0) {
+                open();
+            }
+            if (fd >= 0) {
+                read(chunks);
+                if (!chunks.empty()) {
+                    return true;
+                }
+                if (replaced()) {
+                    continue;
+                }
+            }
+            if (!wait()) {
+                return false;
+            }
+        }
+    }
+
+    void stop() const {
+        waker.wake();
+    }
+
+    /// the number of times the file at path was replaced
+    size_t rotations;
+
+private:
+    void open() {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                return;
+            }
+            throw system_error(errno, system_category(), "tail_file open " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            auto e = errno;
+            ::close(fd);
+            fd = -1;
+            throw system_error(e, system_category(), "tail_file stat " + path);
+        }
+        inode = info.st_ino;
+        offset = 0;
+        // only the file that is at path when the tail starts is read from its end
+        if (!opened && !options.from_start) {
+            offset = static_cast<uint64_t>(::lseek(fd, 0, SEEK_END));
+        }
+    }
+
+    /// reads to the end of the file, in up to 16 chunks
+    void read(vector<buffer_chain>& chunks) {
+        for (int i = 0; i < 16; ++i) {
+            auto chunk = read_buffer_chain(fd, *pool);
+            if (chunk.empty()) {
+                return;
+            }
+            offset += chunk.size();
+            auto full = chunk.size() == options.chunk;
+            chunks.push_back(move(chunk));
+            if (!full) {
+                return;
+            }
+        }
+    }
+
+    /// \returns true when the file was replaced or truncated and must be read again
+    bool replaced() {
+        struct stat info;
+        if (::stat(path.c_str(), &info) != 0) {
+            if (errno != ENOENT) {
+                throw system_error(errno, system_category(), "tail_file stat " + path);
+            }
+            // removed, the open file is followed until another file is at path
+            return false;
+        }
+        if (info.st_ino != inode) {
+            ::close(fd);
+            fd = -1;
+            ++rotations;
+            open();
+            return fd >= 0;
+        }
+        if (static_cast<uint64_t>(info.st_size) < offset) {
+            ::lseek(fd, 0, SEEK_SET);
+            offset = 0;
+            ++rotations;
+            return true;
+        }
+        return false;
+    }
+
+    /// \returns false when stopped
+    bool wait() {
+        for (;;) {
+            auto woke = waker.wait(notify, static_cast<int>(options.poll.count()));
+            if (woke < 0) {
+                return false;
+            }
+            if (woke == 0 || changed()) {
+                return true;
+            }
+        }
+    }
+
+    /// drains the notifications, \returns true when one is for the file
+    bool changed() {
+        bool found = false;
+#if defined(__linux__)
+        alignas(inotify_event) char events[4096];
+        for (;;) {
+            auto count = ::read(notify, events, sizeof(events));
+            if (count <= 0) {
+                break;
+            }
+            for (auto at = events; at < events + count;) {
+                auto event = reinterpret_cast<const inotify_event*>(at);
+                if (event->len == 0 || name == event->name) {
+                    found = true;
+                }
+                at += sizeof(inotify_event) + event->len;
+            }
+        }
+#endif
+        return found;
+    }
+
+    string path;
+    string directory;
+    string name;
+    tail_options options;
+    shared_ptr<buffer_pool> pool;
+    poll_waker waker;
+    int fd;
+    ino_t inode;
+    uint64_t offset;
+    /// the tail has started, a file opened from now on is read from its start
+    bool opened;
+    int notify;
+};
+
+/// \brief splits chunks into lines, a partial line is kept until the rest arrives.
+struct line_splitter
+{
+    template<class Emit>
+    void split(const buffer_chain& chunk, Emit&& emit) {
+        for (auto& s : chunk.slices()) {
+            auto first = s.begin();
+            auto last = s.end();
+            while (first != last) {
+                auto newline = static_cast<const char*>(memchr(first, '\n', static_cast<size_t>(last - first)));
+                if (!newline) {
+                    carry.append(first, last);
+                    break;
+                }
+                auto end = newline;
+                if (carry.empty()) {
+                    if (end != first && end[-1] == '\r') {
+                        --end;
+                    }
+                    emit(string(first, end));
+                } else {
+                    carry.append(first, end);
+                    if (!carry.empty() && carry.back() == '\r') {
+                        carry.pop_back();
+                    }
+                    emit(move(carry));
+                    carry.clear();
+                }
+                first = newline + 1;
+            }
+        }
+    }
+
+    /// a file that ends without a newline ends with its last line
+    template<class Emit>
+    void flush(Emit&& emit) {
+        if (!carry.empty()) {
+            emit(move(carry));
+            carry.clear();
+        }
+    }
+
+    string carry;
+};
+
+/// emits each line as a string
+struct tail_lines
+{
+    template<class Observer>
+    void chunk(Observer& r, buffer_chain c) {
+        lines.split(c, [&](string line){
+            r.next(move(line));
+        });
+    }
+    template<class Observer>
+    void rotated(Observer& r) {
+        lines.flush([&](string line){
+            r.next(move(line));
+        });
+    }
+    line_splitter lines;
+};
+
+/// emits each chunk as it was read
+struct tail_chunks
+{
+    template<class Observer>
+    void chunk(Observer& r, buffer_chain c) {
+        r.next(move(c));
+    }
+    template<class Observer>
+    void rotated(Observer& ) {
+    }
+};
+
+template<class Deliver, class MakeStrand>
+auto make_tail_file(string path, MakeStrand makeStrand, tail_options options){
+    return make_observable([=](auto scrb){
+        info("tail_file bound to subscriber");
+        return make_starter([=](auto ctx) {
+            info("tail_file bound to context");
+            subscription lifetime;
+            ctx.lifetime.insert(lifetime);
+            auto tailcontext = copy_context(lifetime, makeStrand, ctx);
+            auto r = scrb.create(ctx);
+            shared_ptr<file_tail> tail;
+            try {
+                tail = make_shared<file_tail>(path, options);
+            } catch(...) {
+                r.error(current_exception());
+                return ctx.lifetime;
+            }
+            // stopping lifetime is deferred to the strand, which the source blocks
+            ctx.lifetime.insert([tail](){
+                tail->stop();
+            });
+            info("tail_file started");
+            auto run = make_observer(r, subscription{}, [=](auto& r, auto& ){
+                Deliver deliver;
+                vector<buffer_chain> chunks;
+                size_t rotations = 0;
+                for (;;) {
+                    chunks.clear();
+                    // read errors are delivered to error, errors from the observer are not caught
+                    try {
+                        if (!tail->next(chunks)) {
+                            return;
+                        }
+                    } catch(...) {
+                        r.error(current_exception());
+                        return;
+                    }
+                    if (tail->rotations != rotations) {
+                        rotations = tail->rotations;
+                        deliver.rotated(r);
+                    }
+                    for (auto& c : chunks) {
+                        if (r.lifetime.is_stopped()) {
+                            return;
+                        }
+                        deliver.chunk(r, move(c));
+                    }
+                }
+            }, detail::pass{}, detail::skip{});
+            defer(tailcontext, run);
+            return ctx.lifetime;
+        });
+    });
+}
+
+}
+
+/// \brief follows the file at path as it is appended to and emits each new line
+/// (without the newline) as a string. the file is read in large chunks when a
+/// change is notified (by inotify, or every options.poll without it).
+/// when the file is rotated (renamed or removed and replaced) the rest of the old
+/// file is read before the new file is read from its start, a truncated file is
+/// read from its start. the source does not complete, it runs until it is stopped.
+///
+/// the file is read and the lines are delivered on the strand from makeStrand.
+/// the strand is blocked while the source runs, so it should be a new_thread.
+template<class MakeStrand>
+auto tail_file(string path, MakeStrand makeStrand, tail_options options = tail_options{}){
+    info("new tail_file");
+    return detail::make_tail_file<detail::tail_lines>(move(path), makeStrand, options);
+}
+
+/// \brief follows the file at path like tail_file and emits each chunk that is read
+/// as a buffer_chain, the chunks are not split at lines.
+template<class MakeStrand>
+auto tail_file_chunks(string path, MakeStrand makeStrand, tail_options options = tail_options{}){
+    info("new tail_file_chunks");
+    return detail::make_tail_file<detail::tail_chunks>(move(path), makeStrand, options);
+}
+
+#endif
+
+}
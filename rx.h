@@ -15,6 +15,50 @@
 #include <sstream>
 #include <future>
 #include <queue>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <typeinfo>
+#include <cmath>
+#include <algorithm>
+#include <deque>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <unordered_set>
+#include <cstdint>
+#include <tuple>
+
+#include <system_error>
+#include <cstring>
+#include <cerrno>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if !EMSCRIPTEN && (defined(__unix__) || defined(__APPLE__))
+#define RX_POSIX 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/inotify.h>
+#endif
+#else
+#define RX_POSIX 0
+#endif
 
 namespace rx {
 
@@ -83,6 +127,18 @@ using std::decay_t;
 #include "rx_as_interface.h"
 /// joins with the subscription returned from a started operation
 #include "rx_join.h"
+/// a record batch stores the fields of many records as one contiguous column per field
+#include "rx_record_batch.h"
+/// a buffer chain is a sequence of refcounted slices of pooled blocks
+#include "rx_buffer.h"
+/// the framing and flow control shared by socket_sink and socket_source
+#include "rx_socket.h"
+/// a ring buffer in shared memory for shm_ring_sink and shm_ring_source
+#include "rx_shm_ring.h"
+/// the io threads of read_file and write_file
+#include "rx_file_io.h"
+/// per key state for operators, in memory or in a memory mapped file
+#include "rx_keyed_store.h"
 
 /// the pipe operator `operator|()` is used to connect the pieces together.
 ///
@@ -104,6 +160,14 @@ using std::decay_t;
 
 #include "observables/rx_ints.h"
 #include "observables/rx_intervals.h"
+#include "observables/rx_race.h"
+#include "observables/rx_circuit_breaker.h"
+#include "observables/rx_merge_join.h"
+#include "observables/rx_columnar_file.h"
+#include "observables/rx_socket_source.h"
+#include "observables/rx_shm_ring_source.h"
+#include "observables/rx_tail_file.h"
+#include "observables/rx_read_file.h"
 
 #include "lifters/rx_copy_if.h"
 #include "lifters/rx_transform.h"
@@ -111,10 +175,31 @@ using std::decay_t;
 #include "lifters/rx_observe_on.h"
 #include "lifters/rx_finally.h"
 #include "lifters/rx_last_or_default.h"
+#include "lifters/rx_conflate.h"
+#include "lifters/rx_shed_load.h"
+#include "lifters/rx_adaptive_batch.h"
+#include "lifters/rx_reorder_by_time.h"
+#include "lifters/rx_session_window.h"
+#include "lifters/rx_lookup_join.h"
+#include "lifters/rx_filter_in.h"
+#include "lifters/rx_columns.h"
+#include "lifters/rx_write_columnar.h"
+#include "lifters/rx_parse_csv.h"
+#include "lifters/rx_contains.h"
+#include "lifters/rx_frame.h"
+#include "lifters/rx_socket_sink.h"
+#include "lifters/rx_shm_ring_sink.h"
+#include "lifters/rx_write_file.h"
+#include "lifters/rx_spill_buffer.h"
+#include "lifters/rx_checkpoint.h"
+#include "lifters/rx_materialize.h"
+#include "lifters/rx_memoize_transform.h"
+#include "lifters/rx_combine_locally.h"
 
 #include "adaptors/rx_take.h"
 #include "adaptors/rx_merge.h"
 #include "adaptors/rx_transform_merge.h"
+#include "adaptors/rx_hedge.h"
 
 #include "subscribers/rx_printto.h"
 
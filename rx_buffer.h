@@ -0,0 +1,418 @@
+#pragma once
+
+namespace rx {
+
+/// \brief fixed size blocks that are reused once the last reference to them is released.
+/// the pool is shared by the blocks it allocates, so it lives as long as they do.
+class buffer_pool : public enable_shared_from_this<buffer_pool>
+{
+public:
+    explicit buffer_pool(size_t block_size = 64 * 1024, size_t max_free = 64)
+        : size(block_size)
+        , max_free(max_free) {
+    }
+    ~buffer_pool() {
+        for (auto block : free) {
+            delete[] block;
+        }
+    }
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    size_t block_size() const {
+        return size;
+    }
+
+    /// \returns a writable block of block_size() bytes
+    shared_ptr<char> allocate() {
+        char* block = nullptr;
+        {
+            unique_lock<mutex> guard(lock);
+            if (!free.empty()) {
+                block = free.back();
+                free.pop_back();
+            }
+        }
+        if (!block) {
+            block = new char[size];
+        }
+        auto pool = shared_from_this();
+        return shared_ptr<char>(block, [pool](char* block){
+            pool->release(block);
+        });
+    }
+
+private:
+    void release(char* block) {
+        {
+            unique_lock<mutex> guard(lock);
+            if (free.size() < max_free) {
+                free.push_back(block);
+                return;
+            }
+        }
+        delete[] block;
+    }
+
+    mutex lock;
+    size_t size;
+    size_t max_free;
+    vector<char*> free;
+};
+
+/// \returns the pool used when no other pool is given
+inline shared_ptr<buffer_pool> default_buffer_pool() {
+    static auto pool = make_shared<buffer_pool>();
+    return pool;
+}
+
+/// \brief a range of bytes that shares ownership of the memory that holds them.
+struct buffer_slice
+{
+    buffer_slice() : size(0) {}
+    buffer_slice(shared_ptr<const char> data, size_t size) : data(move(data)), size(size) {}
+    /// a slice that owns the bytes of s
+    explicit buffer_slice(string s) : size(s.size()) {
+        auto owner = make_shared<const string>(move(s));
+        data = shared_ptr<const char>(owner, owner->data());
+    }
+
+    /// points at the first byte, shares the owner of the bytes
+    shared_ptr<const char> data;
+    size_t size;
+
+    const char* begin() const {
+        return data.get();
+    }
+    const char* end() const {
+        return data.get() + size;
+    }
+    /// \returns the bytes [offset, offset + count) sharing the same owner
+    buffer_slice sub(size_t offset, size_t count) const {
+        return buffer_slice(shared_ptr<const char>(data, data.get() + offset), count);
+    }
+};
+
+/// \brief a sequence of slices that is treated as one range of bytes.
+/// splitting and appending share the slices and never copy the bytes.
+class buffer_chain
+{
+public:
+    buffer_chain() : bytes(0) {}
+    explicit buffer_chain(buffer_slice s) : bytes(0) {
+        append(move(s));
+    }
+    explicit buffer_chain(string s) : bytes(0) {
+        append(buffer_slice(move(s)));
+    }
+
+    size_t size() const {
+        return bytes;
+    }
+    bool empty() const {
+        return bytes == 0;
+    }
+    const vector<buffer_slice>& slices() const {
+        return parts;
+    }
+    /// true when the bytes are in a single slice
+    bool contiguous() const {
+        return parts.size() <= 1;
+    }
+
+    void append(buffer_slice s) {
+        if (s.size == 0) {
+            return;
+        }
+        bytes += s.size;
+        parts.push_back(move(s));
+    }
+    void append(buffer_chain other) {
+        for (auto& s : other.parts) {
+            append(move(s));
+        }
+    }
+
+    /// \brief removes the first count bytes and returns them as a chain
+    buffer_chain split(size_t count) {
+        buffer_chain result;
+        size_t used = 0;
+        while (count > 0) {
+            auto& front = parts[used];
+            if (front.size <= count) {
+                count -= front.size;
+                bytes -= front.size;
+                result.append(move(front));
+                ++used;
+                continue;
+            }
+            result.append(front.sub(0, count));
+            front = front.sub(count, front.size - count);
+            bytes -= count;
+            count = 0;
+        }
+        parts.erase(parts.begin(), parts.begin() + used);
+        return result;
+    }
+
+    /// \brief removes the first count bytes
+    void consume(size_t count) {
+        split(count);
+    }
+
+    /// \brief copies the first count bytes to out
+    void copy_to(char* out, size_t count) const {
+        for (auto& s : parts) {
+            if (count == 0) {
+                break;
+            }
+            auto n = min(count, s.size);
+            memcpy(out, s.begin(), n);
+            out += n;
+            count -= n;
+        }
+    }
+
+    /// \returns the bytes in one slice, copied only when the chain is not contiguous
+    buffer_slice flatten() const {
+        if (parts.size() == 1) {
+            return parts.front();
+        }
+        string s(bytes, '\0');
+        copy_to(&s[0], bytes);
+        return buffer_slice(move(s));
+    }
+
+    string str() const {
+        string s(bytes, '\0');
+        copy_to(&s[0], bytes);
+        return s;
+    }
+
+#if RX_POSIX
+    /// \brief appends an iovec for each slice, for writev
+    void append_iovecs(vector<iovec>& out) const {
+        for (auto& s : parts) {
+            out.push_back(iovec{const_cast<char*>(s.begin()), s.size});
+        }
+    }
+#endif
+
+private:
+    vector<buffer_slice> parts;
+    size_t bytes;
+};
+
+namespace detail {
+
+inline buffer_chain to_buffer_chain(buffer_chain c) {
+    return c;
+}
+inline buffer_chain to_buffer_chain(buffer_slice s) {
+    return buffer_chain(move(s));
+}
+inline buffer_chain to_buffer_chain(string s) {
+    return buffer_chain(move(s));
+}
+inline buffer_chain to_buffer_chain(const vector<char>& v) {
+    return buffer_chain(string(v.begin(), v.end()));
+}
+inline buffer_chain to_buffer_chain(text_view t) {
+    return buffer_chain(t.str());
+}
+
+/// \brief a vector value is a batch of records, any other value is one record
+template<class T>
+vector<buffer_chain> to_buffer_records(T v) {
+    vector<buffer_chain> records;
+    records.push_back(to_buffer_chain(move(v)));
+    return records;
+}
+
+template<class T, class = enable_if_t<!is_same<T, char>::value>>
+vector<buffer_chain> to_buffer_records(vector<T> batch) {
+    vector<buffer_chain> records;
+    records.reserve(batch.size());
+    for (auto& v : batch) {
+        records.push_back(to_buffer_chain(move(v)));
+    }
+    return records;
+}
+
+#if RX_POSIX
+
+inline void close_on_exec(int fd) {
+    ::fcntl(fd, F_SETFD, ::fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+/// \brief wakes a thread that is blocked waiting for a file descriptor, from any thread.
+class poll_waker
+{
+public:
+    poll_waker() {
+        if (::pipe(fds) != 0) {
+            throw system_error(errno, system_category(), "poll_waker pipe");
+        }
+        for (auto fd : fds) {
+            close_on_exec(fd);
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+    ~poll_waker() {
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+    poll_waker(const poll_waker&) = delete;
+    poll_waker& operator=(const poll_waker&) = delete;
+
+    void wake() const {
+        const char c = 0;
+        // a full pipe is already awake
+        auto result = ::write(fds[1], &c, 1);
+        (void)result;
+    }
+
+    /// \brief waits until fd is readable, or timeout (-1 is forever) passes.
+    /// \returns 1 when fd is readable, 0 on timeout and -1 when woken.
+    int wait(int fd, int timeout = -1) const {
+        pollfd p[2] = {{fds[0], POLLIN, 0}, {fd, POLLIN, 0}};
+        for (;;) {
+            auto result = ::poll(p, fd < 0 ? 1 : 2, timeout);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw system_error(errno, system_category(), "poll");
+            }
+            if (p[0].revents != 0) {
+                return -1;
+            }
+            return result == 0 ? 0 : 1;
+        }
+    }
+
+private:
+    int fds[2];
+};
+
+#endif
+
+}
+
+class frame_error : public runtime_error {
+public:
+  explicit frame_error (const string& what_arg) : runtime_error(what_arg) {}
+  explicit frame_error (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+/// \brief each frame is a big-endian length of prefix bytes (1, 2, 4 or 8) followed by that many bytes.
+/// a frame longer than max_size is an error.
+struct frame_format
+{
+    explicit frame_format(size_t prefix = 4, uint64_t max_size = 64 * 1024 * 1024)
+        : prefix(prefix)
+        , max_size(max_size) {
+        if (prefix != 1 && prefix != 2 && prefix != 4 && prefix != 8) {
+            throw frame_error("frame_format prefix must be 1, 2, 4 or 8 bytes");
+        }
+    }
+    size_t prefix;
+    uint64_t max_size;
+};
+
+namespace detail {
+
+/// \brief splits the bytes that arrive into frames.
+/// a frame that lies within one slice is a slice of the same block, the
+/// bytes are copied only to read a length prefix that spans two slices.
+class frame_decoder
+{
+public:
+    explicit frame_decoder(frame_format format)
+        : format(format)
+        , length(0)
+        , has_length(false) {
+    }
+
+    void push(buffer_chain chunk) {
+        pending.append(move(chunk));
+    }
+
+    /// \returns true and the next frame when one is complete
+    bool next(buffer_chain& frame) {
+        if (!has_length) {
+            if (pending.size() < format.prefix) {
+                return false;
+            }
+            unsigned char prefix[8];
+            pending.copy_to(reinterpret_cast<char*>(prefix), format.prefix);
+            pending.consume(format.prefix);
+            length = 0;
+            for (size_t i = 0; i < format.prefix; ++i) {
+                length = (length << 8) | prefix[i];
+            }
+            if (length > format.max_size) {
+                throw frame_error("frame_decode frame of " + to_string(length) + " bytes is larger than max_size");
+            }
+            has_length = true;
+        }
+        if (pending.size() < length) {
+            return false;
+        }
+        frame = pending.split(static_cast<size_t>(length));
+        has_length = false;
+        return true;
+    }
+
+    /// true when the bytes received end inside a frame
+    bool partial() const {
+        return has_length || !pending.empty();
+    }
+
+private:
+    frame_format format;
+    buffer_chain pending;
+    uint64_t length;
+    bool has_length;
+};
+
+}
+
+#if RX_POSIX
+
+/// \brief writes every slice of chain to fd with as few writev calls as possible.
+/// throws system_error when the write fails.
+inline void write_buffer_chain(int fd, const buffer_chain& chain) {
+    vector<iovec> buffers;
+    chain.append_iovecs(buffers);
+    detail::writev_all(fd, buffers, "write_buffer_chain");
+}
+
+/// \brief reads what is available from fd, up to one block, into a block from pool.
+/// \returns the bytes read, an empty chain at end of file.
+/// throws system_error when the read fails, EAGAIN is returned as an empty chain
+/// with would_block set.
+inline buffer_chain read_buffer_chain(int fd, buffer_pool& pool, bool* would_block = nullptr) {
+    if (would_block) {
+        *would_block = false;
+    }
+    auto block = pool.allocate();
+    for (;;) {
+        auto count = ::read(fd, block.get(), pool.block_size());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && would_block) {
+                *would_block = true;
+                return buffer_chain{};
+            }
+            throw system_error(errno, system_category(), "read_buffer_chain");
+        }
+        return buffer_chain(buffer_slice(shared_ptr<const char>(block), static_cast<size_t>(count)));
+    }
+}
+
+#endif
+
+}
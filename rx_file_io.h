@@ -0,0 +1,103 @@
+#pragma once
+
+namespace rx {
+
+/// \brief threads that run blocking file reads and writes for read_file and write_file,
+/// so that the strands that deliver the values are never blocked by the disk.
+/// each thread takes all of the queued jobs at once, so a burst of requests
+/// costs one lock and one wakeup per thread.
+class file_io
+{
+public:
+    explicit file_io(size_t threads = 2)
+        : shared(make_shared<queue_state>()) {
+        for (size_t i = 0; i < max<size_t>(threads, 1); ++i) {
+            // the threads own the queue, a job may release the last reference to this
+            thread([q = shared](){
+                run(*q);
+            }).detach();
+        }
+    }
+    ~file_io() {
+        unique_lock<mutex> guard(shared->lock);
+        shared->stopped = true;
+        shared->wake.notify_all();
+    }
+    file_io(const file_io&) = delete;
+    file_io& operator=(const file_io&) = delete;
+
+    void submit(function<void()> job) {
+        unique_lock<mutex> guard(shared->lock);
+        shared->jobs.push_back(move(job));
+        shared->wake.notify_one();
+    }
+
+private:
+    struct queue_state
+    {
+        queue_state() : stopped(false) {}
+        mutex lock;
+        condition_variable wake;
+        deque<function<void()>> jobs;
+        bool stopped;
+    };
+
+    static void run(queue_state& q) {
+        deque<function<void()>> batch;
+        unique_lock<mutex> guard(q.lock);
+        for (;;) {
+            q.wake.wait(guard, [&](){return q.stopped || !q.jobs.empty();});
+            if (q.jobs.empty()) {
+                return;
+            }
+            swap(batch, q.jobs);
+            guard.unlock();
+            for (auto& job : batch) {
+                job();
+            }
+            batch.clear();
+            guard.lock();
+        }
+    }
+
+    shared_ptr<queue_state> shared;
+};
+
+inline shared_ptr<file_io> make_file_io(size_t threads = 2) {
+    return make_shared<file_io>(threads);
+}
+
+/// \brief the part of a file that read_file reads.
+/// chunk is the size of each read and read_ahead the number of chunks
+/// that are read before they are delivered.
+struct read_options
+{
+    explicit read_options(uint64_t offset = 0, uint64_t length = numeric_limits<uint64_t>::max(), size_t chunk = 1024 * 1024, size_t read_ahead = 4)
+        : offset(offset)
+        , length(length)
+        , chunk(max<size_t>(chunk, 1))
+        , read_ahead(max<size_t>(read_ahead, 1)) {
+    }
+    uint64_t offset;
+    uint64_t length;
+    size_t chunk;
+    size_t read_ahead;
+};
+
+/// \brief how write_file writes.
+/// the file is truncated unless append is true. a producer that is more than
+/// write_behind bytes ahead of the disk waits for the writes to catch up.
+/// sync calls fsync before the file is closed.
+struct write_options
+{
+    explicit write_options(bool append = false, size_t write_behind = 64 * 1024 * 1024, bool sync = false)
+        : append(append)
+        , write_behind(max<size_t>(write_behind, 1))
+        , sync(sync) {
+    }
+    bool append;
+    size_t write_behind;
+    bool sync;
+};
+
+}
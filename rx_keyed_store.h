@@ -0,0 +1,572 @@
+#pragma once
+
+namespace rx {
+
+/// a keyed store holds a Value for each Key of an operator. each store provides
+///   Value* find(const Key&)      nullptr when the key is not in the store
+///   Value& get(const Key&)       inserts Value{} when the key is not in the store
+///   bool erase(const Key&)
+///   size_t size()
+///   void for_each(f)             calls f(const Key&, Value&) for each entry
+/// the pointers and references are valid until the next change to the store.
+/// a store is not synchronized, it is used from the strand of its operator.
+/// an operator creates its store from its context with make_keyed_state(ctx.lifetime, ...),
+/// as it creates other state with make_state.
+
+namespace detail {
+
+/// fibonacci hashing spreads identity hashes (such as hash<int>) across the table.
+/// the slot is chosen by the high bits. 0 marks an empty slot, so the low bit is always set.
+inline uint64_t keyed_tag(size_t h) {
+    return (static_cast<uint64_t>(h) * 0x9E3779B97F4A7C15ull) | 1;
+}
+
+/// \brief removes the slot at hole from a linear probing table and moves the
+/// entries that follow it back, so that no probe runs past an empty slot.
+template<class Slots, class Tag, class Move, class Clear>
+void keyed_backward_shift(size_t hole, size_t mask, int shift, Slots&& slots, Tag tag, Move move_slot, Clear clear) {
+    auto next = (hole + 1) & mask;
+    while (tag(slots, next) != 0) {
+        auto home = static_cast<size_t>(tag(slots, next) >> shift);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            move_slot(slots, hole, next);
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    clear(slots, hole);
+}
+
+}
+
+/// \brief a keyed store in memory with open addressing and linear probing.
+/// the slots hold only the mixed hash and the position of the entry, the entries
+/// are dense so that for_each walks one array.
+template<class Key, class Value, class Hash = hash<Key>>
+class memory_keyed_store
+{
+public:
+    using key_type = Key;
+    using value_type = Value;
+    using entry_type = pair<Key, Value>;
+
+    explicit memory_keyed_store(size_t capacity = 16, Hash h = Hash{})
+        : h(h)
+        , mask(0)
+        , shift(0) {
+        resize(capacity);
+    }
+
+    Value* find(const Key& k) {
+        auto at = probe(k, detail::keyed_tag(h(k)));
+        return slots[at].tag == 0 ? nullptr : &entries[slots[at].position].second;
+    }
+
+    Value& get(const Key& k) {
+        auto tag = detail::keyed_tag(h(k));
+        auto at = probe(k, tag);
+        if (slots[at].tag != 0) {
+            return entries[slots[at].position].second;
+        }
+        if ((entries.size() + 1) * 4 > slots.size() * 3) {
+            resize(slots.size() * 2);
+            at = probe(k, tag);
+        }
+        slots[at] = slot{tag, entries.size()};
+        entries.emplace_back(k, Value{});
+        return entries.back().second;
+    }
+
+    bool erase(const Key& k) {
+        auto at = probe(k, detail::keyed_tag(h(k)));
+        if (slots[at].tag == 0) {
+            return false;
+        }
+        auto position = slots[at].position;
+        remove(at);
+        if (position + 1 != entries.size()) {
+            // the last entry fills the gap
+            slots[probe(entries.back().first, detail::keyed_tag(h(entries.back().first)))].position = position;
+            entries[position] = move(entries.back());
+        }
+        entries.pop_back();
+        return true;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    template<class F>
+    void for_each(F&& f) {
+        for (auto& e : entries) {
+            f(static_cast<const Key&>(e.first), e.second);
+        }
+    }
+
+    void clear() {
+        entries.clear();
+        slots.assign(slots.size(), slot{0, 0});
+    }
+
+private:
+    struct slot
+    {
+        uint64_t tag;
+        size_t position;
+    };
+
+    void resize(size_t capacity) {
+        size_t count = 2;
+        int bits = 1;
+        while (count < capacity) {
+            count *= 2;
+            ++bits;
+        }
+        mask = count - 1;
+        shift = numeric_limits<uint64_t>::digits - bits;
+        slots.assign(count, slot{0, 0});
+        for (size_t i = 0; i < entries.size(); ++i) {
+            auto tag = detail::keyed_tag(h(entries[i].first));
+            auto at = static_cast<size_t>(tag >> shift);
+            while (slots[at].tag != 0) {
+                at = (at + 1) & mask;
+            }
+            slots[at] = slot{tag, i};
+        }
+    }
+
+    /// \returns the slot that holds k or the empty slot where k would be inserted
+    size_t probe(const Key& k, uint64_t tag) const {
+        auto at = static_cast<size_t>(tag >> shift);
+        while (slots[at].tag != 0 && (slots[at].tag != tag || !(entries[slots[at].position].first == k))) {
+            at = (at + 1) & mask;
+        }
+        return at;
+    }
+
+    void remove(size_t at) {
+        detail::keyed_backward_shift(at, mask, shift, slots,
+            [](vector<slot>& s, size_t i){ return s[i].tag; },
+            [](vector<slot>& s, size_t to, size_t from){ s[to] = s[from]; },
+            [](vector<slot>& s, size_t i){ s[i] = slot{0, 0}; });
+    }
+
+    Hash h;
+    size_t mask;
+    int shift;
+    vector<slot> slots;
+    vector<entry_type> entries;
+};
+
+#if RX_POSIX
+
+class keyed_store_error : public runtime_error {
+public:
+  explicit keyed_store_error (const string& what_arg) : runtime_error(what_arg) {}
+  explicit keyed_store_error (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+/// \brief where mmap_keyed_store keeps its table.
+/// capacity is the initial number of slots, the table doubles when it is 3/4 full.
+/// cache is the number of hot entries that are held in memory.
+struct mmap_store_options
+{
+    explicit mmap_store_options(string path, size_t capacity = 64 * 1024, size_t cache = 4096)
+        : path(move(path))
+        , capacity(capacity)
+        , cache(cache) {
+    }
+    string path;
+    size_t capacity;
+    size_t cache;
+};
+
+namespace detail {
+
+struct keyed_file_header
+{
+    uint64_t magic;
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t slots;
+    uint64_t size;
+};
+
+}
+
+/// \brief a keyed store in a memory mapped file, for state that is larger than memory.
+/// the file is a linear probing table of fixed size entries, so Key and Value must be
+/// trivially copyable. the pages are written out by the kernel and read again on use.
+/// the entries that are used most recently are copied to a small direct mapped cache
+/// in memory and written back to the file when they are replaced.
+///
+/// the file is kept at path, a store that opens an existing file continues with its entries.
+template<class Key, class Value, class Hash = hash<Key>>
+class mmap_keyed_store
+{
+    static_assert(is_trivially_copyable<Key>::value && is_trivially_copyable<Value>::value, "mmap_keyed_store requires trivially copyable keys and values");
+    static_assert(is_default_constructible<Key>::value && is_default_constructible<Value>::value, "mmap_keyed_store requires default constructible keys and values");
+public:
+    using key_type = Key;
+    using value_type = Value;
+
+    explicit mmap_keyed_store(mmap_store_options options, Hash h = Hash{})
+        : options(move(options))
+        , h(h)
+        , fd(-1)
+        , base(nullptr)
+        , length(0)
+        , header(nullptr)
+        , table(nullptr)
+        , mask(0)
+        , shift(0) {
+        size_t lines = 1;
+        while (lines < this->options.cache) {
+            lines *= 2;
+        }
+        cache.assign(lines, cached{});
+        open();
+    }
+    ~mmap_keyed_store() {
+        try {
+            flush();
+        } catch(...) {
+        }
+        unmap();
+    }
+    mmap_keyed_store(const mmap_keyed_store&) = delete;
+    mmap_keyed_store& operator=(const mmap_keyed_store&) = delete;
+
+    Value* find(const Key& k) {
+        auto tag = detail::keyed_tag(h(k));
+        auto& c = line(tag);
+        if (c.tag == tag && c.key == k) {
+            return &c.value;
+        }
+        auto at = probe(k, tag);
+        if (table[at].tag == 0) {
+            return nullptr;
+        }
+        return &load(c, table[at]).value;
+    }
+
+    Value& get(const Key& k) {
+        auto tag = detail::keyed_tag(h(k));
+        auto& c = line(tag);
+        if (c.tag == tag && c.key == k) {
+            return c.value;
+        }
+        auto at = probe(k, tag);
+        if (table[at].tag == 0) {
+            if ((header->size + 1) * 4 > header->slots * 3) {
+                grow();
+                at = probe(k, tag);
+            }
+            table[at].tag = tag;
+            table[at].key = k;
+            table[at].value = Value{};
+            ++header->size;
+        }
+        return load(c, table[at]).value;
+    }
+
+    bool erase(const Key& k) {
+        auto tag = detail::keyed_tag(h(k));
+        auto& c = line(tag);
+        if (c.tag == tag && c.key == k) {
+            c.tag = 0;
+        }
+        auto at = probe(k, tag);
+        if (table[at].tag == 0) {
+            return false;
+        }
+        detail::keyed_backward_shift(at, mask, shift, table,
+            [](entry* t, size_t i){ return t[i].tag; },
+            [](entry* t, size_t to, size_t from){ t[to] = t[from]; },
+            [](entry* t, size_t i){ t[i].tag = 0; });
+        --header->size;
+        return true;
+    }
+
+    size_t size() const {
+        return static_cast<size_t>(header->size);
+    }
+
+    template<class F>
+    void for_each(F&& f) {
+        flush();
+        for (size_t i = 0; i < header->slots; ++i) {
+            if (table[i].tag != 0) {
+                f(static_cast<const Key&>(table[i].key), table[i].value);
+            }
+        }
+    }
+
+    /// \brief writes the cached entries back to the file
+    void flush() {
+        for (auto& c : cache) {
+            store(c);
+            c.tag = 0;
+        }
+    }
+
+    /// \brief flushes and waits until the file is written to the disk
+    void sync() {
+        flush();
+        if (::msync(base, length, MS_SYNC) != 0) {
+            throw system_error(errno, system_category(), "mmap_keyed_store sync " + options.path);
+        }
+    }
+
+    /// \brief flushes and copies the table to a file at path, which another
+    /// mmap_keyed_store can open. the kernel copies the pages (or shares them, on
+    /// file systems that clone ranges), the entries are not read into memory.
+    void copy_to(const string& path) {
+        flush();
+        auto file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file < 0) {
+            throw system_error(errno, system_category(), "mmap_keyed_store open " + path);
+        }
+        size_t copied = 0;
+#if defined(__linux__) && defined(SYS_copy_file_range)
+        loff_t from = 0;
+        while (copied < length) {
+            auto count = ::syscall(SYS_copy_file_range, fd, &from, file, nullptr, length - copied, 0u);
+            if (count <= 0) {
+                // across file systems, on older kernels, the rest is written from the mapping
+                break;
+            }
+            copied += static_cast<size_t>(count);
+        }
+#endif
+        while (copied < length) {
+            auto count = ::pwrite(file, base + copied, length - copied, static_cast<off_t>(copied));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0) {
+                auto e = errno;
+                ::close(file);
+                throw system_error(e, system_category(), "mmap_keyed_store write " + path);
+            }
+            copied += static_cast<size_t>(count);
+        }
+        ::close(file);
+    }
+
+private:
+    struct entry
+    {
+        uint64_t tag;
+        Key key;
+        Value value;
+    };
+
+    struct cached
+    {
+        cached() : tag(0), key(), value() {}
+        uint64_t tag;
+        Key key;
+        Value value;
+    };
+
+    /// the entries start on the cache line after the header
+    static size_t table_offset() {
+        return (sizeof(detail::keyed_file_header) + 63) / 64 * 64;
+    }
+
+    cached& line(uint64_t tag) {
+        // the table uses the high bits, the cache uses the bits below them
+        return cache[static_cast<size_t>(tag >> 16) & (cache.size() - 1)];
+    }
+
+    cached& load(cached& c, const entry& e) {
+        store(c);
+        c.tag = e.tag;
+        c.key = e.key;
+        c.value = e.value;
+        return c;
+    }
+
+    void store(const cached& c) {
+        if (c.tag == 0) {
+            return;
+        }
+        auto at = probe(c.key, c.tag);
+        if (table[at].tag != 0) {
+            table[at].value = c.value;
+        }
+    }
+
+    size_t probe(const Key& k, uint64_t tag) const {
+        auto at = static_cast<size_t>(tag >> shift);
+        while (table[at].tag != 0 && (table[at].tag != tag || !(table[at].key == k))) {
+            at = (at + 1) & mask;
+        }
+        return at;
+    }
+
+    static size_t slot_count(size_t capacity) {
+        size_t count = 2;
+        while (count < capacity) {
+            count *= 2;
+        }
+        return count;
+    }
+
+    void open() {
+        fd = ::open(options.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw system_error(errno, system_category(), "mmap_keyed_store open " + options.path);
+        }
+        try {
+            struct stat info;
+            if (::fstat(fd, &info) != 0) {
+                throw system_error(errno, system_category(), "mmap_keyed_store stat " + options.path);
+            }
+            if (info.st_size == 0) {
+                create(fd, options.path, slot_count(options.capacity));
+            } else if (static_cast<size_t>(info.st_size) < table_offset()) {
+                throw keyed_store_error("mmap_keyed_store " + options.path + " is too short for a table");
+            }
+            map();
+            check();
+        } catch(...) {
+            unmap();
+            throw;
+        }
+    }
+
+    /// \brief rejects a file that is not a whole table of these keys and values
+    void check() const {
+        if (header->magic != magic() || header->key_size != sizeof(Key) || header->value_size != sizeof(Value)) {
+            throw keyed_store_error("mmap_keyed_store " + options.path + " is not a table of these keys and values");
+        }
+        auto slots = header->slots;
+        if (slots == 0 || (slots & (slots - 1)) != 0 || header->size > slots ||
+            slots > (length - table_offset()) / sizeof(entry) || length != table_offset() + slots * sizeof(entry)) {
+            throw keyed_store_error("mmap_keyed_store " + options.path + " has " + to_string(length) +
+                " bytes, which do not match its table of " + to_string(slots) + " slots");
+        }
+    }
+
+    static uint64_t magic() {
+        return 0x7278736b65796564ull;
+    }
+
+    static void create(int file, const string& path, size_t slots) {
+        auto size = table_offset() + slots * sizeof(entry);
+        if (::ftruncate(file, static_cast<off_t>(size)) != 0) {
+            throw system_error(errno, system_category(), "mmap_keyed_store size " + path);
+        }
+        detail::keyed_file_header h{magic(), sizeof(Key), sizeof(Value), slots, 0};
+        if (::pwrite(file, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))) {
+            throw system_error(errno, system_category(), "mmap_keyed_store write " + path);
+        }
+    }
+
+    void map() {
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            throw system_error(errno, system_category(), "mmap_keyed_store stat " + options.path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        auto mapped = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            throw system_error(errno, system_category(), "mmap_keyed_store map " + options.path);
+        }
+        base = static_cast<char*>(mapped);
+        header = reinterpret_cast<detail::keyed_file_header*>(base);
+        table = reinterpret_cast<entry*>(base + table_offset());
+        auto bits = 0;
+        for (auto count = header->slots; count > 1; count /= 2) {
+            ++bits;
+        }
+        mask = static_cast<size_t>(header->slots - 1);
+        shift = numeric_limits<uint64_t>::digits - bits;
+    }
+
+    void unmap() {
+        if (base) {
+            ::munmap(base, length);
+            base = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    /// \brief doubles the table into a new file that replaces the file at path
+    void grow() {
+        auto path = options.path + ".grow";
+        auto file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file < 0) {
+            throw system_error(errno, system_category(), "mmap_keyed_store open " + path);
+        }
+        auto slots = static_cast<size_t>(header->slots * 2);
+        void* mapped = MAP_FAILED;
+        try {
+            create(file, path, slots);
+            auto size = table_offset() + slots * sizeof(entry);
+            mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            if (mapped == MAP_FAILED) {
+                throw system_error(errno, system_category(), "mmap_keyed_store map " + path);
+            }
+            auto grown = reinterpret_cast<entry*>(static_cast<char*>(mapped) + table_offset());
+            auto grown_shift = shift - 1;
+            for (size_t i = 0; i < header->slots; ++i) {
+                if (table[i].tag == 0) {
+                    continue;
+                }
+                auto at = static_cast<size_t>(table[i].tag >> grown_shift);
+                while (grown[at].tag != 0) {
+                    at = (at + 1) & (slots - 1);
+                }
+                grown[at] = table[i];
+            }
+            reinterpret_cast<detail::keyed_file_header*>(mapped)->size = header->size;
+            ::munmap(mapped, size);
+            if (::rename(path.c_str(), options.path.c_str()) != 0) {
+                throw system_error(errno, system_category(), "mmap_keyed_store rename " + path);
+            }
+        } catch(...) {
+            ::close(file);
+            ::unlink(path.c_str());
+            throw;
+        }
+        unmap();
+        fd = file;
+        map();
+    }
+
+    mmap_store_options options;
+    Hash h;
+    int fd;
+    char* base;
+    size_t length;
+    detail::keyed_file_header* header;
+    entry* table;
+    size_t mask;
+    int shift;
+    vector<cached> cache;
+};
+
+#endif
+
+/// \brief a memory_keyed_store that lives as long as lifetime.
+template<class Key, class Value, class Hash = hash<Key>>
+state<memory_keyed_store<Key, Value, Hash>> make_keyed_state(subscription lifetime, size_t capacity = 16, Hash h = Hash{}) {
+    return make_state<memory_keyed_store<Key, Value, Hash>>(lifetime, capacity, h);
+}
+
+#if RX_POSIX
+/// \brief a mmap_keyed_store that lives as long as lifetime.
+template<class Key, class Value, class Hash = hash<Key>>
+state<mmap_keyed_store<Key, Value, Hash>> make_keyed_state(subscription lifetime, mmap_store_options options, Hash h = Hash{}) {
+    return make_state<mmap_keyed_store<Key, Value, Hash>>(lifetime, move(options), h);
+}
+#endif
+
+}
@@ -0,0 +1,396 @@
+#pragma once
+
+namespace rx {
+
+/// \brief the values of one field for every row of a batch in a contiguous array.
+/// the validity bitmap has one bit per row, set when the row is not null.
+/// an empty bitmap means that no row is null.
+template<class T>
+class column
+{
+public:
+    using value_type = T;
+
+    column() : nulls(0) {}
+    /// \brief a column from values and a validity bitmap with nulls cleared bits
+    column(vector<T> values, vector<uint64_t> validity, size_t nulls)
+        : values(move(values))
+        , validity(move(validity))
+        , nulls(nulls) {
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+    size_t null_count() const {
+        return nulls;
+    }
+    bool is_valid(size_t row) const {
+        return validity.empty() || ((validity[row / 64] >> (row % 64)) & 1) != 0;
+    }
+    const T* data() const {
+        return values.data();
+    }
+    T* data() {
+        return values.data();
+    }
+    typename vector<T>::const_reference operator[](size_t row) const {
+        return values[row];
+    }
+    const vector<T>& all() const {
+        return values;
+    }
+    /// \returns the bitmap, nullptr when no row is null
+    const uint64_t* validity_data() const {
+        return nulls == 0 ? nullptr : validity.data();
+    }
+
+    void reserve(size_t rows) {
+        values.reserve(rows);
+    }
+    void push_back(T v) {
+        values.push_back(move(v));
+        if (!validity.empty()) {
+            set_valid(values.size() - 1, true);
+        }
+    }
+    /// \brief appends a null row, with a value initialized T in the values
+    void push_null() {
+        if (validity.empty()) {
+            // every row before this one was valid
+            validity.assign(values.size() / 64 + 1, ~uint64_t(0));
+        }
+        values.push_back(T{});
+        set_valid(values.size() - 1, false);
+        ++nulls;
+    }
+
+    /// \brief replaces the values and keeps the validity of each row.
+    template<class U>
+    column<U> with_values(vector<U> replacement) const {
+        column<U> result;
+        result.values = move(replacement);
+        result.validity = validity;
+        result.nulls = nulls;
+        return result;
+    }
+
+    /// \brief makes each row null that is null in other
+    template<class U>
+    void intersect_validity(const column<U>& other) {
+        if (other.validity.empty()) {
+            return;
+        }
+        if (validity.empty()) {
+            validity = other.validity;
+        } else {
+            for (size_t i = 0; i < validity.size() && i < other.validity.size(); ++i) {
+                validity[i] &= other.validity[i];
+            }
+        }
+        nulls = 0;
+        for (size_t row = 0; row < values.size(); ++row) {
+            nulls += is_valid(row) ? 0 : 1;
+        }
+    }
+
+    /// \brief the rows listed in selection in a new column
+    column gather(const vector<uint32_t>& selection) const {
+        column result;
+        result.values.reserve(selection.size());
+        if (validity.empty()) {
+            for (auto row : selection) {
+                result.values.push_back(values[row]);
+            }
+            return result;
+        }
+        for (auto row : selection) {
+            if (is_valid(row)) {
+                result.push_back(values[row]);
+            } else {
+                result.push_null();
+            }
+        }
+        return result;
+    }
+
+private:
+    template<class U>
+    friend class column;
+
+    void set_valid(size_t row, bool valid) {
+        if (validity.size() <= row / 64) {
+            validity.resize(row / 64 + 1, ~uint64_t(0));
+        }
+        auto bit = uint64_t(1) << (row % 64);
+        validity[row / 64] = valid ? (validity[row / 64] | bit) : (validity[row / 64] & ~bit);
+    }
+
+    vector<T> values;
+    vector<uint64_t> validity;
+    size_t nulls;
+};
+
+/// \brief a batch of records with a fixed schema, stored as one column per field.
+/// the selection lists the rows that are part of the batch, in increasing order,
+/// so that filtering a batch does not copy the columns. when there is no
+/// selection every row is part of the batch.
+template<class... Tn>
+struct record_batch
+{
+    using columns_type = tuple<column<Tn>...>;
+    static const size_t width = sizeof...(Tn);
+
+    record_batch() : rows(0), selected(false) {}
+
+    columns_type columns;
+    size_t rows;
+    bool selected;
+    vector<uint32_t> selection;
+
+    /// \returns the number of rows that are part of the batch
+    size_t size() const {
+        return selected ? selection.size() : rows;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void reserve(size_t count) {
+        reserve(count, make_index_sequence<width>{});
+    }
+
+    void push_back(Tn... vn) {
+        push_back(make_index_sequence<width>{}, move(vn)...);
+        ++rows;
+    }
+
+    /// \brief calls f(row) for each row that is part of the batch
+    template<class F>
+    void for_each_row(F&& f) const {
+        if (selected) {
+            for (auto row : selection) {
+                f(static_cast<size_t>(row));
+            }
+            return;
+        }
+        for (size_t row = 0; row < rows; ++row) {
+            f(row);
+        }
+    }
+
+    /// \returns a batch without a selection that holds only the selected rows
+    record_batch compacted() const {
+        if (!selected) {
+            return *this;
+        }
+        return compacted(make_index_sequence<width>{});
+    }
+
+private:
+    template<size_t... In>
+    void reserve(size_t count, index_sequence<In...>) {
+        int unpack[] = {0, (get<In>(columns).reserve(count), 0)...};
+        (void)unpack;
+    }
+    template<size_t... In>
+    void push_back(index_sequence<In...>, Tn&&... vn) {
+        int unpack[] = {0, (get<In>(columns).push_back(move(vn)), 0)...};
+        (void)unpack;
+    }
+    template<size_t... In>
+    record_batch compacted(index_sequence<In...>) const {
+        record_batch result;
+        result.columns = columns_type{get<In>(columns).gather(selection)...};
+        result.rows = selection.size();
+        return result;
+    }
+};
+
+template<class... Tn>
+const size_t record_batch<Tn...>::width;
+
+/// \returns the column for field I of the batch
+template<size_t I, class... Tn>
+auto& get_column(record_batch<Tn...>& batch) {
+    return get<I>(batch.columns);
+}
+template<size_t I, class... Tn>
+const auto& get_column(const record_batch<Tn...>& batch) {
+    return get<I>(batch.columns);
+}
+
+/// \brief a read-only column over memory that is owned elsewhere, such as a mapped file.
+/// the view shares ownership of that memory.
+template<class T>
+class column_view
+{
+public:
+    using value_type = T;
+
+    column_view() : values(nullptr), validity(nullptr), rows(0), nulls(0) {}
+    /// validity may be nullptr when no row is null
+    column_view(const T* values, const uint64_t* validity, size_t rows, size_t nulls, shared_ptr<const void> owner)
+        : values(values)
+        , validity(nulls == 0 ? nullptr : validity)
+        , rows(rows)
+        , nulls(nulls)
+        , owner(move(owner)) {
+    }
+
+    size_t size() const {
+        return rows;
+    }
+    size_t null_count() const {
+        return nulls;
+    }
+    bool is_valid(size_t row) const {
+        return !validity || ((validity[row / 64] >> (row % 64)) & 1) != 0;
+    }
+    const T* data() const {
+        return values;
+    }
+    const T& operator[](size_t row) const {
+        return values[row];
+    }
+    const column_view& all() const {
+        return *this;
+    }
+    const uint64_t* validity_data() const {
+        return validity;
+    }
+
+    /// \returns a column that owns a copy of the values
+    column<T> to_column() const {
+        return with_values(vector<T>(values, values + rows));
+    }
+
+    template<class U>
+    column<U> with_values(vector<U> replacement) const {
+        vector<uint64_t> bits;
+        if (validity) {
+            bits.assign(validity, validity + (rows + 63) / 64);
+        }
+        return column<U>(move(replacement), move(bits), nulls);
+    }
+
+private:
+    const T* values;
+    const uint64_t* validity;
+    size_t rows;
+    size_t nulls;
+    shared_ptr<const void> owner;
+};
+
+/// \brief a record_batch of column_views. copy_if_column and reduce_column accept
+/// views directly, to_batch() copies the columns for the other operators.
+template<class... Tn>
+struct record_batch_view
+{
+    using columns_type = tuple<column_view<Tn>...>;
+    using batch_type = record_batch<Tn...>;
+    static const size_t width = sizeof...(Tn);
+
+    record_batch_view() : rows(0), selected(false) {}
+
+    columns_type columns;
+    size_t rows;
+    bool selected;
+    vector<uint32_t> selection;
+
+    size_t size() const {
+        return selected ? selection.size() : rows;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+
+    template<class F>
+    void for_each_row(F&& f) const {
+        if (selected) {
+            for (auto row : selection) {
+                f(static_cast<size_t>(row));
+            }
+            return;
+        }
+        for (size_t row = 0; row < rows; ++row) {
+            f(row);
+        }
+    }
+
+    /// \returns a record_batch with a copy of every column and the same selection
+    batch_type to_batch() const {
+        return to_batch(make_index_sequence<width>{});
+    }
+
+private:
+    template<size_t... In>
+    batch_type to_batch(index_sequence<In...>) const {
+        batch_type result;
+        result.columns = typename batch_type::columns_type{get<In>(columns).to_column()...};
+        result.rows = rows;
+        result.selected = selected;
+        result.selection = selection;
+        return result;
+    }
+};
+
+template<class... Tn>
+const size_t record_batch_view<Tn...>::width;
+
+template<size_t I, class... Tn>
+auto& get_column(record_batch_view<Tn...>& batch) {
+    return get<I>(batch.columns);
+}
+template<size_t I, class... Tn>
+const auto& get_column(const record_batch_view<Tn...>& batch) {
+    return get<I>(batch.columns);
+}
+
+namespace detail {
+
+template<size_t I, class R, class Batch, class Indices>
+struct replace_column_type;
+template<size_t I, class R, class... Tn, size_t... In>
+struct replace_column_type<I, R, record_batch<Tn...>, index_sequence<In...>>
+{
+    using type = record_batch<conditional_t<In == I, R, Tn>...>;
+};
+
+}
+
+/// \brief the type of Batch with field I changed to R
+template<size_t I, class R, class Batch>
+using replace_column_t = typename detail::replace_column_type<I, R, decay_t<Batch>, make_index_sequence<decay_t<Batch>::width>>::type;
+
+namespace detail {
+
+template<bool Replace, class R, class T>
+enable_if_t<Replace, column<R>> choose_column(column<R>&& replacement, column<T>&& ) {
+    return move(replacement);
+}
+template<bool Replace, class R, class T>
+enable_if_t<!Replace, column<T>> choose_column(column<R>&& , column<T>&& original) {
+    return move(original);
+}
+
+template<size_t I, class R, class... Tn, size_t... In>
+auto replace_column(record_batch<Tn...>&& batch, column<R>&& replacement, index_sequence<In...>) {
+    replace_column_t<I, R, record_batch<Tn...>> result;
+    result.columns = typename decltype(result)::columns_type{
+        choose_column<In == I>(move(replacement), move(get<In>(batch.columns)))...};
+    result.rows = batch.rows;
+    result.selected = batch.selected;
+    result.selection = move(batch.selection);
+    return result;
+}
+
+}
+
+/// \returns the batch with field I replaced by the replacement column
+template<size_t I, class R, class... Tn>
+auto replace_column(record_batch<Tn...> batch, column<R> replacement) {
+    return detail::replace_column<I>(move(batch), move(replacement), make_index_sequence<sizeof...(Tn)>{});
+}
+
+}
@@ -0,0 +1,501 @@
+#pragma once
+
+namespace rx {
+
+const size_t shm_ring_max_producers = 64;
+
+/// \brief the shared memory ring between shm_ring_sink and shm_ring_source.
+/// capacity is the size of the ring in bytes (rounded up to a power of two),
+/// a record must fit in half of it. the source completes once producers sinks
+/// (at most shm_ring_max_producers) have completed. the sinks retry for connect_timeout
+/// while the source has not created the ring yet.
+struct shm_ring_options
+{
+    explicit shm_ring_options(size_t capacity = 16 * 1024 * 1024, size_t producers = 1, milliseconds connect_timeout = seconds(5))
+        : capacity(4096)
+        , producers(min(max<size_t>(producers, 1), shm_ring_max_producers))
+        , connect_timeout(connect_timeout) {
+        while (this->capacity < capacity) {
+            this->capacity *= 2;
+        }
+    }
+    size_t capacity;
+    size_t producers;
+    milliseconds connect_timeout;
+};
+
+#if RX_POSIX
+
+namespace detail {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shm_ring needs address-free atomics");
+
+/// \brief waits while word == expected, for at most timeout.
+/// a futex on linux, otherwise a short sleep.
+inline void shm_wait(atomic<uint32_t>& word, uint32_t expected, milliseconds timeout) {
+#if defined(__linux__)
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    ts.tv_nsec = static_cast<long>((timeout.count() % 1000) * 1000000);
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+    (void)timeout;
+    if (word.load() == expected) {
+        this_thread::sleep_for(microseconds(200));
+    }
+#endif
+}
+
+/// \brief wakes all the threads, in any process, that wait on word.
+inline void shm_wake(atomic<uint32_t>& word) {
+#if defined(__linux__)
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, numeric_limits<int>::max(), nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+/// \brief takes a write lock on the byte at of fd. the kernel releases the lock
+/// when fd is closed, also when the process dies, so a held lock marks a live
+/// source or sink. open file description locks are used so that a source and a
+/// sink in one process are told apart. without them no lock is taken.
+inline bool shm_lock(int fd, off_t at) {
+#if defined(F_OFD_SETLK)
+    struct flock l;
+    memset(&l, 0, sizeof(l));
+    l.l_type = F_WRLCK;
+    l.l_whence = SEEK_SET;
+    l.l_start = at;
+    l.l_len = 1;
+    return ::fcntl(fd, F_OFD_SETLK, &l) == 0;
+#else
+    (void)fd;
+    (void)at;
+    return true;
+#endif
+}
+
+/// \returns true when the byte at is locked through another open of the ring.
+/// without open file description locks the lock is assumed to be held.
+inline bool shm_locked(int fd, off_t at) {
+#if defined(F_OFD_GETLK)
+    struct flock l;
+    memset(&l, 0, sizeof(l));
+    l.l_type = F_WRLCK;
+    l.l_whence = SEEK_SET;
+    l.l_start = at;
+    l.l_len = 1;
+    if (::fcntl(fd, F_OFD_GETLK, &l) != 0) {
+        return true;
+    }
+    return l.l_type != F_UNLCK;
+#else
+    (void)fd;
+    (void)at;
+    return true;
+#endif
+}
+
+const uint64_t shm_ring_magic = 0x31474e4952585200;
+
+/// \brief the start of the shared memory, the ring follows it.
+/// the fields written by the producers and by the consumer are in separate cache lines.
+/// the source holds a lock on byte 0 of the shared memory and each sink a lock on
+/// byte 1 + its slot, see shm_lock.
+struct shm_ring_header
+{
+    atomic<uint64_t> magic;
+    uint64_t capacity;
+    uint64_t producers;
+
+    /// the next position that a producer reserves
+    alignas(64) atomic<uint64_t> reserved;
+    /// bumped after each record is committed
+    atomic<uint32_t> committed;
+    atomic<uint32_t> consumer_waiting;
+
+    /// the position that the consumer has read up to
+    alignas(64) atomic<uint64_t> tail;
+    /// bumped after the consumer frees space
+    atomic<uint32_t> consumed;
+    atomic<uint32_t> producers_waiting;
+
+    alignas(64) atomic<uint32_t> completed;
+    /// 0 no error, 1 an error is being written, 2 the error is in message
+    atomic<uint32_t> failed;
+    uint32_t message_size;
+    char message[1024];
+
+    /// the number of sinks that opened the ring, each claims the next slot
+    atomic<uint32_t> attached;
+    /// shm_slot_running while the sink in the slot may write, then shm_slot_done
+    atomic<uint32_t> slots[shm_ring_max_producers];
+};
+
+const uint32_t shm_slot_running = 1;
+const uint32_t shm_slot_done = 2;
+
+// the kind of an entry is the low 32 bits of its header, the length of the bytes
+// that follow the header is the high 32 bits. an entry that is reserved and not
+// yet committed has a zero header.
+const uint32_t shm_record = 1;
+const uint32_t shm_padding = 2;
+
+inline size_t shm_ring_offset() {
+    return (sizeof(shm_ring_header) + 4095) & ~size_t(4095);
+}
+
+/// \brief the mapping of a ring, shared by the source that creates it and the sinks that open it.
+/// records are [header][bytes] padded to 8 bytes. a record that does not fit before
+/// the end of the ring is placed at the start, after a padding entry.
+/// producers reserve space with a compare-exchange and commit the header last, so
+/// many sinks may write to one ring. the consumer zeroes what it has read, so
+/// that a reserved entry reads as uncommitted.
+class shm_ring
+{
+public:
+    /// creates the ring. a ring with the same name that is left by a source that
+    /// exited is replaced, a ring that a live source holds is an error.
+    shm_ring(string name, const shm_ring_options& options)
+        : name(move(name))
+        , owner(true)
+        , size(shm_ring_offset() + options.capacity)
+        , memory(nullptr)
+        , fd(-1)
+        , slot(0) {
+        for (;;) {
+            fd = ::shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd >= 0) {
+                break;
+            }
+            if (errno != EEXIST) {
+                throw system_error(errno, system_category(), "shm_ring create " + this->name);
+            }
+            auto existing = ::shm_open(this->name.c_str(), O_RDWR, 0600);
+            if (existing >= 0) {
+                auto live = shm_locked(existing, 0);
+                ::close(existing);
+                if (live) {
+                    throw system_error(EEXIST, system_category(), "shm_ring create " + this->name + " is in use");
+                }
+            }
+            ::shm_unlink(this->name.c_str());
+        }
+        try {
+            if (!shm_lock(fd, 0) || ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                throw system_error(errno, system_category(), "shm_ring size " + this->name);
+            }
+            map();
+        } catch(...) {
+            ::close(fd);
+            ::shm_unlink(this->name.c_str());
+            throw;
+        }
+        auto h = new (memory) shm_ring_header();
+        h->capacity = options.capacity;
+        h->producers = options.producers;
+        h->magic.store(shm_ring_magic, memory_order_release);
+    }
+
+    /// opens the ring that a source created, waiting for up to timeout, and
+    /// claims a slot for this sink.
+    /// \returns nullptr when stopped returns true first.
+    template<class Stopped>
+    static unique_ptr<shm_ring> open(const string& name, milliseconds timeout, Stopped stopped) {
+        auto deadline = steady_clock::now() + timeout;
+        for (;;) {
+            auto fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+            if (fd >= 0) {
+                struct stat info;
+                if (::fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) > shm_ring_offset()) {
+                    unique_ptr<shm_ring> ring(new shm_ring(name, static_cast<size_t>(info.st_size)));
+                    ring->fd = fd;
+                    ring->map();
+                    auto& h = ring->header();
+                    if (h.magic.load(memory_order_acquire) == shm_ring_magic && ring->source_alive()) {
+                        ring->attach();
+                        return ring;
+                    }
+                } else {
+                    ::close(fd);
+                }
+            } else if (errno != ENOENT) {
+                throw system_error(errno, system_category(), "shm_ring open " + name);
+            }
+            if (steady_clock::now() >= deadline) {
+                throw system_error(ENOENT, system_category(), "shm_ring open " + name);
+            }
+            if (stopped()) {
+                return nullptr;
+            }
+            this_thread::sleep_for(milliseconds(10));
+        }
+    }
+
+    ~shm_ring() {
+        if (memory) {
+            ::munmap(memory, size);
+        }
+        if (fd >= 0) {
+            // releases the lock of this source or sink
+            ::close(fd);
+        }
+        unlink();
+    }
+
+    /// \brief removes the name of a ring that this created, the mapping stays valid.
+    void unlink() {
+        if (owner) {
+            ::shm_unlink(name.c_str());
+            owner = false;
+        }
+    }
+    shm_ring(const shm_ring&) = delete;
+    shm_ring& operator=(const shm_ring&) = delete;
+
+    shm_ring_header& header() const {
+        return *static_cast<shm_ring_header*>(memory);
+    }
+    char* ring() const {
+        return static_cast<char*>(memory) + shm_ring_offset();
+    }
+    uint64_t capacity() const {
+        return header().capacity;
+    }
+    atomic<uint64_t>& entry(uint64_t position) const {
+        return *reinterpret_cast<atomic<uint64_t>*>(ring() + (position & (capacity() - 1)));
+    }
+
+    /// \brief copies the record into the ring, waiting while the ring is full.
+    /// \returns false when stopped returns true first.
+    template<class Stopped>
+    bool write(const buffer_chain& record, Stopped stopped) {
+        auto& h = header();
+        auto bytes = 8 + ((record.size() + 7) & ~size_t(7));
+        if (bytes > h.capacity / 2) {
+            throw runtime_error("shm_ring record of " + to_string(record.size()) + " bytes does not fit in the ring");
+        }
+        uint64_t head = h.reserved.load();
+        uint64_t reserve = 0;
+        for (;;) {
+            auto to_end = h.capacity - (head & (h.capacity - 1));
+            reserve = bytes <= to_end ? bytes : to_end + bytes;
+            auto freed = h.consumed.load();
+            if (head + reserve - h.tail.load(memory_order_acquire) > h.capacity) {
+                if (stopped()) {
+                    return false;
+                }
+                if (!source_alive()) {
+                    throw runtime_error("shm_ring " + name + " source exited");
+                }
+                h.producers_waiting.fetch_add(1);
+                if (head + reserve - h.tail.load(memory_order_acquire) > h.capacity) {
+                    shm_wait(h.consumed, freed, milliseconds(50));
+                }
+                h.producers_waiting.fetch_sub(1);
+                head = h.reserved.load();
+                continue;
+            }
+            if (h.reserved.compare_exchange_weak(head, head + reserve)) {
+                break;
+            }
+        }
+        if (reserve != bytes) {
+            entry(head).store(((reserve - bytes - 8) << 32) | shm_padding, memory_order_release);
+            head += reserve - bytes;
+        }
+        auto out = ring() + (head & (h.capacity - 1)) + 8;
+        for (auto& s : record.slices()) {
+            memcpy(out, s.begin(), s.size);
+            out += s.size;
+        }
+        entry(head).store((uint64_t(record.size()) << 32) | shm_record, memory_order_release);
+        h.committed.fetch_add(1);
+        if (h.consumer_waiting.load() != 0) {
+            shm_wake(h.committed);
+        }
+        return true;
+    }
+
+    /// \brief copies the committed records into blocks from pool, at most limit of them.
+    /// an entry that does not fit in the ring is an error, the ring is not read past it.
+    /// \returns the number of records read.
+    size_t read(vector<buffer_chain>& records, buffer_pool& pool, size_t limit) {
+        auto& h = header();
+        auto tail = h.tail.load(memory_order_relaxed);
+        auto start = tail;
+        shared_ptr<char> block;
+        size_t used = 0;
+        size_t count = 0;
+        while (count < limit) {
+            auto e = entry(tail).load(memory_order_acquire);
+            auto kind = static_cast<uint32_t>(e & 0xffffffff);
+            auto length = static_cast<size_t>(e >> 32);
+            if (kind == 0) {
+                break;
+            }
+            auto at = ring() + (tail & (h.capacity - 1));
+            auto bytes = 8 + ((length + 7) & ~size_t(7));
+            // a record fits in half of the ring, a padding entry ends at the end of the ring
+            auto fits = kind == shm_record ? bytes <= h.capacity / 2 :
+                kind == shm_padding && bytes == h.capacity - (tail & (h.capacity - 1));
+            if (!fits) {
+                if (tail != start) {
+                    h.tail.store(tail, memory_order_release);
+                }
+                throw runtime_error("shm_ring " + name + " has an entry of kind " + to_string(kind) +
+                    " and " + to_string(length) + " bytes that does not fit");
+            }
+            if (kind == shm_record) {
+                records.push_back(copy_record(at + 8, length, pool, block, used));
+                ++count;
+            }
+            memset(at, 0, bytes);
+            tail += bytes;
+        }
+        if (tail != start) {
+            h.tail.store(tail, memory_order_release);
+            h.consumed.fetch_add(1);
+            if (h.producers_waiting.load() != 0) {
+                shm_wake(h.consumed);
+            }
+        }
+        return count;
+    }
+
+    /// \brief waits for a record to be committed.
+    template<class Stopped>
+    void wait(Stopped stopped) {
+        auto& h = header();
+        auto seen = h.committed.load();
+        h.consumer_waiting.store(1);
+        if ((entry(h.tail.load()).load() & 0xffffffff) == 0 && !stopped()) {
+            shm_wait(h.committed, seen, milliseconds(50));
+        }
+        h.consumer_waiting.store(0);
+    }
+
+    /// \brief wakes the threads that wait in this process or any other.
+    void wake() {
+        shm_wake(header().committed);
+        shm_wake(header().consumed);
+    }
+
+    /// true when every producer completed and their records were read
+    bool drained() const {
+        auto& h = header();
+        return h.completed.load() >= h.producers && h.reserved.load() == h.tail.load();
+    }
+
+    void complete() {
+        header().slots[slot].store(shm_slot_done);
+        header().completed.fetch_add(1);
+        wake();
+    }
+
+    /// \brief records the first error of any producer.
+    void fail(const string& what) {
+        auto& h = header();
+        h.slots[slot].store(shm_slot_done);
+        uint32_t none = 0;
+        if (h.failed.compare_exchange_strong(none, 1)) {
+            h.message_size = static_cast<uint32_t>(min(what.size(), sizeof(h.message)));
+            memcpy(h.message, what.data(), h.message_size);
+            h.failed.store(2, memory_order_release);
+        }
+        wake();
+    }
+
+    /// \returns true and the error message of a producer when one failed
+    bool failure(string& what) const {
+        auto& h = header();
+        if (h.failed.load(memory_order_acquire) != 2) {
+            return false;
+        }
+        what.assign(h.message, h.message_size);
+        return true;
+    }
+
+    /// true while the source that created the ring holds it
+    bool source_alive() const {
+        return shm_locked(fd, 0);
+    }
+
+    /// true when a sink exited without completing or failing
+    bool abandoned() const {
+        auto& h = header();
+        auto count = min<size_t>(h.attached.load(), shm_ring_max_producers);
+        for (size_t i = 0; i < count; ++i) {
+            if (h.slots[i].load() == shm_slot_running && !shm_locked(fd, static_cast<off_t>(i + 1))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    shm_ring(string name, size_t size)
+        : name(move(name))
+        , owner(false)
+        , size(size)
+        , memory(nullptr)
+        , fd(-1)
+        , slot(0) {
+    }
+
+    /// maps fd, which stays open while the ring holds its lock
+    void map() {
+        memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED) {
+            memory = nullptr;
+            throw system_error(errno, system_category(), "shm_ring map " + name);
+        }
+    }
+
+    /// \brief checks the header that the source wrote and claims the next slot
+    void attach() {
+        auto& h = header();
+        auto capacity = h.capacity;
+        if (capacity < 4096 || (capacity & (capacity - 1)) != 0 || shm_ring_offset() + capacity > size ||
+            h.producers == 0 || h.producers > shm_ring_max_producers) {
+            throw runtime_error("shm_ring " + name + " has an invalid header");
+        }
+        slot = h.attached.fetch_add(1);
+        if (slot >= h.producers) {
+            throw runtime_error("shm_ring " + name + " already has the " + to_string(h.producers) + " sinks of its source");
+        }
+        if (!shm_lock(fd, static_cast<off_t>(slot + 1))) {
+            throw system_error(errno, system_category(), "shm_ring lock " + name);
+        }
+        h.slots[slot].store(shm_slot_running);
+    }
+
+    static buffer_chain copy_record(const char* data, size_t length, buffer_pool& pool, shared_ptr<char>& block, size_t& used) {
+        if (length > pool.block_size()) {
+            return buffer_chain(string(data, length));
+        }
+        if (!block || used + length > pool.block_size()) {
+            block = pool.allocate();
+            used = 0;
+        }
+        memcpy(block.get() + used, data, length);
+        buffer_slice slice(shared_ptr<const char>(block, block.get() + used), length);
+        used += (length + 7) & ~size_t(7);
+        return buffer_chain(move(slice));
+    }
+
+    string name;
+    bool owner;
+    size_t size;
+    void* memory;
+    /// open for as long as the ring, it holds the lock
+    int fd;
+    /// the slot of a sink
+    size_t slot;
+};
+
+}
+
+#endif
+
+}
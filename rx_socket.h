@@ -0,0 +1,163 @@
+#pragma once
+
+namespace rx {
+
+/// \brief an error that was delivered to a socket_sink in another process and
+/// forwarded to the socket_source. the message is the what() of the original.
+class remote_error : public runtime_error {
+public:
+  explicit remote_error (const string& what_arg) : runtime_error(what_arg) {}
+  explicit remote_error (const char* what_arg) : runtime_error(what_arg) {}
+};
+
+/// \brief flow control for socket_sink and socket_source.
+/// credit is the number of records the sink may send ahead of the records that
+/// the source has delivered. a frame holds at most max_frame bytes of records.
+/// the sink retries for connect_timeout while the source is not listening yet.
+struct socket_options
+{
+    explicit socket_options(size_t credit = 4096, size_t max_frame = 4 * 1024 * 1024, milliseconds connect_timeout = seconds(5))
+        : credit(max<size_t>(credit, 1))
+        , max_frame(max<size_t>(max_frame, 64))
+        , connect_timeout(connect_timeout) {
+    }
+    size_t credit;
+    size_t max_frame;
+    milliseconds connect_timeout;
+};
+
+#if RX_POSIX
+
+namespace detail {
+
+// the first byte of each frame
+const char socket_batch = 'B';
+const char socket_credit = 'K';
+const char socket_complete = 'C';
+const char socket_failed = 'E';
+
+inline void put_uint32(char* out, uint32_t value) {
+    for (int i = 3; i >= 0; --i, value >>= 8) {
+        out[i] = static_cast<char>(value & 0xff);
+    }
+}
+inline uint32_t get_uint32(const unsigned char* in) {
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+}
+
+/// \returns the what() of the exception, which is all that crosses the socket
+inline string error_message(exception_ptr e) {
+    try {
+        rethrow_exception(e);
+    } catch(const exception& ex) {
+        return ex.what();
+    } catch(...) {
+    }
+    return "unknown error";
+}
+
+inline sockaddr_un unix_address(const string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw system_error(ENAMETOOLONG, system_category(), "unix socket path " + path);
+    }
+    memcpy(address.sun_path, path.data(), path.size());
+    return address;
+}
+
+/// \brief sends all of the buffers to a socket without raising SIGPIPE.
+inline void send_all(int fd, vector<iovec>& buffers, const string& what) {
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    size_t first = 0;
+    while (first < buffers.size()) {
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = buffers.data() + first;
+        message.msg_iovlen = min<size_t>(buffers.size() - first, IOV_MAX);
+        auto sent = ::sendmsg(fd, &message, flags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw system_error(errno, system_category(), what);
+        }
+        advance_iovecs(buffers, first, static_cast<size_t>(sent));
+    }
+}
+
+/// \brief a connected stream socket that carries frames of [length][kind][body].
+/// the length is 4 bytes, big-endian and counts the kind and the body.
+class socket_channel
+{
+public:
+    socket_channel(int fd, const socket_options& options)
+        : fd(fd)
+        , decoder(frame_format(4, options.max_frame))
+        , pool(make_shared<buffer_pool>(64 * 1024, 4)) {
+#if defined(SO_NOSIGPIPE)
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    }
+    ~socket_channel() {
+        ::close(fd);
+    }
+    socket_channel(const socket_channel&) = delete;
+    socket_channel& operator=(const socket_channel&) = delete;
+
+    void send(char kind, const buffer_chain& body) {
+        string prefix(5, kind);
+        put_uint32(&prefix[0], static_cast<uint32_t>(body.size() + 1));
+        iov.clear();
+        iov.push_back(iovec{&prefix[0], prefix.size()});
+        body.append_iovecs(iov);
+        send_all(fd, iov, "socket send");
+    }
+
+    void send_credit(uint32_t credit) {
+        string body(4, '\0');
+        put_uint32(&body[0], credit);
+        send(socket_credit, buffer_chain(move(body)));
+    }
+
+    /// \brief reads until a frame is complete.
+    /// \returns false when the waker was woken first.
+    bool receive(buffer_chain& body, char& kind, const poll_waker& waker) {
+        while (!decoder.next(body)) {
+            if (waker.wait(fd) < 0) {
+                return false;
+            }
+            bool would_block = false;
+            auto chunk = read_buffer_chain(fd, *pool, &would_block);
+            if (chunk.empty() && !would_block) {
+                throw system_error(ECONNRESET, system_category(), "socket closed by the peer before completion");
+            }
+            decoder.push(move(chunk));
+        }
+        if (body.empty()) {
+            throw frame_error("socket frame without a kind");
+        }
+        body.copy_to(&kind, 1);
+        body.consume(1);
+        return true;
+    }
+
+    const int fd;
+
+private:
+    frame_decoder decoder;
+    shared_ptr<buffer_pool> pool;
+    vector<iovec> iov;
+};
+
+}
+
+#endif
+
+}
@@ -57,5 +57,152 @@ using clock_time_point_t = time_point_t<clock_t<T>>;
 template<class T>
 using clock_duration_t = duration_t<clock_t<T>>;
 
+namespace detail {
+
+template<class F>
+struct callable_argument : public callable_argument<decltype(&decay_t<F>::operator())> {};
+template<class R, class A>
+struct callable_argument<R(*)(A)> {using type = decay_t<A>;};
+template<class C, class R, class A>
+struct callable_argument<R(C::*)(A)> {using type = decay_t<A>;};
+template<class C, class R, class A>
+struct callable_argument<R(C::*)(A) const> {using type = decay_t<A>;};
+
+/// \brief the value type that a function with one (non-auto) parameter accepts.
+template<class F>
+using callable_argument_t = typename callable_argument<F>::type;
+
+template<bool... Bn>
+struct bool_pack {};
+/// \brief true_type when every Bn is true
+template<bool... Bn>
+using all_true = is_same<bool_pack<Bn..., true>, bool_pack<true, Bn...>>;
+
+/// \returns the index of the lowest set bit, mask must not be 0
+inline int count_trailing_zeros(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int n = 0;
+    for (; (mask & 1) == 0; mask >>= 1) {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+#if RX_POSIX
+
+/// \brief skips the buffers, starting at first, that written bytes completed
+/// and moves the start of a partially written buffer.
+inline void advance_iovecs(vector<iovec>& buffers, size_t& first, size_t written) {
+    while (first < buffers.size() && written >= buffers[first].iov_len) {
+        written -= buffers[first].iov_len;
+        ++first;
+    }
+    if (written > 0) {
+        buffers[first].iov_base = static_cast<char*>(buffers[first].iov_base) + written;
+        buffers[first].iov_len -= written;
+    }
+}
+
+/// \brief writes all of the buffers, continuing after partial writes.
+/// the buffers are modified. throws system_error when the write fails.
+inline void writev_all(int fd, vector<iovec>& buffers, const string& what) {
+    size_t first = 0;
+    while (first < buffers.size()) {
+        auto count = static_cast<int>(min<size_t>(buffers.size() - first, IOV_MAX));
+        auto written = ::writev(fd, buffers.data() + first, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw system_error(errno, system_category(), what);
+        }
+        advance_iovecs(buffers, first, static_cast<size_t>(written));
+    }
+}
+
+#endif
+
+/// \brief holds one object for each type that it is asked for.
+/// operators are not bound to the value type, this allows state that 
+/// depends on the value type to be allocated lazily when the first value
+/// of that type arrives. a source that emits values of more than one type
+/// gets a separate object for each type.
+struct late_bound
+{
+    template<class T, class... AN>
+    T& get(AN&&... an) {
+        auto& type = typeid(T);
+        for (auto& b : bound) {
+            if (b.first == &type || *b.first == type) {
+                return *static_cast<T*>(b.second.get());
+            }
+        }
+        bound.emplace_back(&type, make_shared<T>(forward<AN>(an)...));
+        return *static_cast<T*>(bound.back().second.get());
+    }
+
+    /// \returns true when an object of a type other than T is held
+    template<class T>
+    bool holds_other() const {
+        auto& type = typeid(T);
+        for (auto& b : bound) {
+            if (b.first != &type && *b.first != type) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    vector<pair<const type_info*, shared_ptr<void>>> bound;
+};
+
+}
+
+/// \brief a range of characters owned by something else (like std::string_view, which is C++17).
+struct text_view
+{
+    text_view() : first(nullptr), count(0) {}
+    text_view(const char* first, size_t count) : first(first), count(count) {}
+    text_view(const string& s) : first(s.data()), count(s.size()) {}
+
+    const char* first;
+    size_t count;
+
+    const char* data() const {
+        return first;
+    }
+    size_t size() const {
+        return count;
+    }
+    bool empty() const {
+        return count == 0;
+    }
+    const char* begin() const {
+        return first;
+    }
+    const char* end() const {
+        return first + count;
+    }
+    char operator[](size_t i) const {
+        return first[i];
+    }
+    string str() const {
+        return string(first, count);
+    }
+};
+
+inline bool operator==(const text_view& lhs, const text_view& rhs) {
+    return lhs.size() == rhs.size() && (lhs.size() == 0 || memcmp(lhs.data(), rhs.data(), lhs.size()) == 0);
+}
+inline bool operator!=(const text_view& lhs, const text_view& rhs) {
+    return !(lhs == rhs);
+}
+inline ostream& operator<<(ostream& os, const text_view& t) {
+    return os.write(t.data(), static_cast<streamsize>(t.size()));
+}
+
 
 }